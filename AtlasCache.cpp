@@ -0,0 +1,274 @@
+#include "AtlasCache.h"
+#include "Hash.h"
+#include "FileUtil.h"
+#include "SDL.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+const char kMagic[8] = { 'S', 'D', 'L', 'M', 'A', 'T', 'L', 'S' };
+
+/// Bump whenever the layout of the file or of stbtt_packedchar changes.
+const uint32_t kFormatVersion = 6;
+
+/// Layout of the beginning of a cache file; followed by the glyphs, the kerning pairs and the pixels.
+struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t glyphRecordSize;
+
+	// the key
+	uint64_t fontPathHash;
+	uint64_t fontDevice;
+	uint64_t fontInode;
+	int64_t fontModificationTime;
+	uint64_t fontByteSize;
+	uint64_t fontContentHash;
+	uint64_t fontSizesHash;
+	uint32_t fontSizeCount;
+	uint32_t charsets;
+	uint32_t atlasMode;
+	uint32_t subpixelPhases;
+
+	// the payload
+	uint32_t glyphCount;
+	uint32_t kerningPairCount;
+	uint32_t width;
+	uint32_t height;
+	uint32_t pitch;
+};
+
+void FillKey(FileHeader& header, const AtlasCache::Key& key)
+{
+	header.fontPathHash = HashBytes(key.fontPath.data(), key.fontPath.size());
+	header.fontDevice = key.fontDevice;
+	header.fontInode = key.fontInode;
+	header.fontModificationTime = key.fontModificationTime;
+	header.fontByteSize = key.fontByteSize;
+	header.fontContentHash = key.fontContentHash;
+	header.fontSizesHash = HashBytes(key.fontSizes.data(), key.fontSizes.size() * sizeof(float));
+	header.fontSizeCount = key.fontSizes.size();
+	header.charsets = key.charsets;
+	header.atlasMode = key.atlasMode;
+	header.subpixelPhases = key.subpixelPhases;
+}
+
+/// Byte size of the whole file as described by the header.
+uint64_t ExpectedFileSize(const FileHeader& header)
+{
+	return sizeof(FileHeader)
+		+ uint64_t(header.glyphCount) * sizeof(AtlasCache::Glyph)
+		+ uint64_t(header.kerningPairCount) * sizeof(KerningPair)
+		+ uint64_t(header.pitch) * header.height;
+}
+
+/// True if the image of every glyph lies within the atlas (the compose path reads the pixels without checking).
+bool AreGlyphsInAtlas(const AtlasCache::Glyph* glyphs, uint32_t glyphCount, uint32_t width, uint32_t height)
+{
+	for (uint32_t i = 0; i < glyphCount; i++) {
+		const stbtt_packedchar& g = glyphs[i].geometry;
+		if (g.x0 > g.x1 || g.x1 > width || g.y0 > g.y1 || g.y1 > height) return false;
+	}
+	return true;
+}
+
+/// Hashes the sfnt table directory of a mapped font face, or the whole of a font that has been read in.
+uint64_t HashFontContent(const FontCollection& collection, int faceIndex)
+{
+	// a font that was read from a pipe has no identity to tell its versions apart,
+	// but it is all in memory already, so hashing it costs no I/O
+	const ByteSource& fontFile = collection.GetFile();
+	if (!fontFile.IsMapped()) {
+		return HashBytes(fontFile.GetData(), fontFile.GetSize());
+	}
+
+	// Hashing the whole font would fault in every page of it on each run,
+	// which is exactly the work the cache is supposed to save; the table
+	// directory carries a checksum of every table, so hashing it is enough
+	// to notice that the content has changed.
+	uint32_t offset = collection.GetFaceOffset(faceIndex);
+	const uint8_t* directory = fontFile.GetData() + offset;
+	size_t directorySize = 12 + 16 * ((directory[4] << 8) | directory[5]);
+	directorySize = std::min(directorySize, fontFile.GetSize() - offset);
+	return HashBytes(directory, directorySize);
+}
+
+/// The path of the font file, with the face index if it is not the first face of a collection.
+std::string FacePath(const FontCollection::FaceRef& face)
+{
+	std::string path = face.collection->GetFile().GetFileName();
+	if (face.index != 0) {
+		path += '#' + std::to_string(face.index);
+	}
+	return path;
+}
+
+} // namespace
+
+//---
+
+AtlasCache::Entry::Entry(std::unique_ptr<MappedFile> file_)
+	: file(std::move(file_))
+{
+	const FileHeader* header = reinterpret_cast<const FileHeader*>(file->GetData());
+	glyphs = reinterpret_cast<const Glyph*>(file->GetData() + sizeof(FileHeader));
+	glyphCount = header->glyphCount;
+	kerningPairs = reinterpret_cast<const KerningPair*>(file->GetData() + sizeof(FileHeader) + glyphCount * sizeof(Glyph));
+	kerningPairCount = header->kerningPairCount;
+	pixels = reinterpret_cast<const uint8_t*>(kerningPairs + kerningPairCount);
+	width = header->width;
+	height = header->height;
+	pitch = header->pitch;
+}
+
+//---
+
+AtlasCache::AtlasCache(const std::string& directory_)
+	: directory(directory_)
+{
+}
+
+//---
+
+std::string AtlasCache::DefaultDirectory()
+{
+	const char* xdgCacheHome = getenv("XDG_CACHE_HOME");
+	if (xdgCacheHome && xdgCacheHome[0] == '/') {
+		return std::string(xdgCacheHome) + "/sdlmessage";
+	}
+	const char* home = getenv("HOME");
+	if (home && home[0]) {
+		return std::string(home) + "/.cache/sdlmessage";
+	}
+	return "/tmp/sdlmessage-cache";
+}
+
+//---
+
+AtlasCache::Key AtlasCache::MakeKey(const std::vector<FontCollection::FaceRef>& fontFaces, const std::vector<float>& fontSizes,
+	uint32_t charsets, uint32_t atlasMode, uint32_t subpixelPhases)
+{
+	const FontCollection::FaceRef& fontFace = fontFaces.front();
+	const ByteSource& fontFile = fontFace.collection->GetFile();
+
+	// only a mapped file is identified by its device, inode and modification time
+	Key key;
+	key.fontPath = FacePath(fontFace);
+	if (fontFile.IsMapped()) {
+		key.fontDevice = fontFile.GetDevice();
+		key.fontInode = fontFile.GetInode();
+		key.fontModificationTime = fontFile.GetModificationTime();
+	}
+	key.fontByteSize = fontFile.GetSize();
+	key.fontSizes = fontSizes;
+	key.charsets = charsets;
+	key.atlasMode = atlasMode;
+	key.subpixelPhases = subpixelPhases;
+	key.fontContentHash = HashFontContent(*fontFace.collection, fontFace.index);
+
+	// a different chain gets a different entry; a changed fallback font invalidates it
+	for (size_t i = 1; i < fontFaces.size(); i++) {
+		const ByteSource& fallback = fontFaces[i].collection->GetFile();
+		key.fontPath += '\n';
+		key.fontPath += FacePath(fontFaces[i]);
+
+		uint64_t identity[] = {
+			fallback.IsMapped() ? fallback.GetDevice() : 0,
+			fallback.IsMapped() ? fallback.GetInode() : 0,
+			fallback.IsMapped() ? uint64_t(fallback.GetModificationTime()) : 0,
+			fallback.GetSize(),
+			HashFontContent(*fontFaces[i].collection, fontFaces[i].index)
+		};
+		key.fontContentHash = HashBytes(identity, sizeof(identity), key.fontContentHash);
+	}
+	return key;
+}
+
+//---
+
+std::string AtlasCache::GetEntryPath(const Key& key) const
+{
+	uint64_t hash = HashBytes(key.fontPath.data(), key.fontPath.size());
+	hash = HashBytes(key.fontSizes.data(), key.fontSizes.size() * sizeof(float), hash);
+	hash = HashBytes(&key.charsets, sizeof(key.charsets), hash);
+	hash = HashBytes(&key.atlasMode, sizeof(key.atlasMode), hash);
+	hash = HashBytes(&key.subpixelPhases, sizeof(key.subpixelPhases), hash);
+
+	char name[64];
+	snprintf(name, sizeof(name), "/atlas-%016llx.bin", static_cast<unsigned long long>(hash));
+	return directory + name;
+}
+
+//---
+
+std::unique_ptr<AtlasCache::Entry> AtlasCache::Load(const Key& key) const
+{
+	auto file = std::make_unique<MappedFile>(GetEntryPath(key).c_str());
+	if (!file->Ok() || file->GetSize() < sizeof(FileHeader)) {
+		return nullptr;
+	}
+
+	FileHeader expected = { 0 };
+	FillKey(expected, key);
+
+	const FileHeader* header = reinterpret_cast<const FileHeader*>(file->GetData());
+	if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0
+		|| header->version != kFormatVersion
+		|| header->glyphRecordSize != sizeof(Glyph)
+		|| header->fontPathHash != expected.fontPathHash
+		|| header->fontDevice != expected.fontDevice
+		|| header->fontInode != expected.fontInode
+		|| header->fontModificationTime != expected.fontModificationTime
+		|| header->fontByteSize != expected.fontByteSize
+		|| header->fontContentHash != expected.fontContentHash
+		|| header->fontSizesHash != expected.fontSizesHash
+		|| header->fontSizeCount != expected.fontSizeCount
+		|| header->charsets != expected.charsets
+		|| header->atlasMode != expected.atlasMode
+		|| header->subpixelPhases != expected.subpixelPhases
+		|| header->pitch < header->width
+		|| ExpectedFileSize(*header) != file->GetSize()
+	) {
+		return nullptr;
+	}
+
+	// a file damaged after the header could still send glyphs outside the pixels
+	const Glyph* glyphs = reinterpret_cast<const Glyph*>(file->GetData() + sizeof(FileHeader));
+	if (!AreGlyphsInAtlas(glyphs, header->glyphCount, header->width, header->height)) {
+		return nullptr;
+	}
+
+	return std::make_unique<Entry>(std::move(file));
+}
+
+//---
+
+bool AtlasCache::Store(const Key& key, const std::vector<Glyph>& glyphs, const std::vector<KerningPair>& kerningPairs,
+	const uint8_t* pixels, int width, int height, int pitch) const
+{
+	if (!MakeDirectories(directory)) {
+		return false;
+	}
+
+	FileHeader header = { 0 };
+	memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kFormatVersion;
+	header.glyphRecordSize = sizeof(Glyph);
+	FillKey(header, key);
+	header.glyphCount = glyphs.size();
+	header.kerningPairCount = kerningPairs.size();
+	header.width = width;
+	header.height = height;
+	header.pitch = pitch;
+
+	return WriteFileAtomically(GetEntryPath(key), {
+		{ &header, sizeof(header) },
+		{ glyphs.data(), glyphs.size() * sizeof(Glyph) },
+		{ kerningPairs.data(), kerningPairs.size() * sizeof(KerningPair) },
+		{ pixels, size_t(pitch) * height }
+	});
+}
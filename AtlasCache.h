@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <vector>
+
+#include "MapFile.h"
+#include "FontCollection.h"
+#include "Kerning.h"
+
+#include "stb_truetype.h"
+
+/**
+ * On-disk cache of packed glyph atlases.
+ *
+ * Each cache file holds the INDEX8 atlas pixels together with the packed
+ * geometry of every glyph and the kerning among the glyphs, so that a later run can map the file and skip
+ * rasterization entirely. Files are keyed by the identity of every font face
+ * of the fallback chain (path and face index, device, inode, modification time,
+ * size and a hash of its table directory; for a font read from a pipe, a hash
+ * of all of it instead), the font sizes, the set of encoded
+ * charsets, the atlas mode and the subpixel phases; an entry whose key does not match is treated as a miss and
+ * gets overwritten.
+ *
+ * Entries are written to a temporary file first and renamed into place,
+ * so a reader never sees a partially written entry, even when several
+ * processes populate the cache at the same time.
+ */
+class AtlasCache
+{
+public:
+
+	/// Everything a cached atlas depends on.
+	struct Key {
+		std::string fontPath;
+		uint64_t fontDevice = 0;
+		uint64_t fontInode = 0;
+		int64_t fontModificationTime = 0;
+		uint64_t fontByteSize = 0;
+		uint64_t fontContentHash = 0;
+		std::vector<float> fontSizes;
+		uint32_t charsets = 0;
+		uint32_t atlasMode = 0;		///< What the pixels mean (Font::AtlasMode; not interpreted by the cache).
+		uint32_t subpixelPhases = 1;	///< Horizontal oversampling of the glyphs.
+	};
+
+	/// One glyph as stored in the cache.
+	struct Glyph {
+		int32_t codepoint;
+		int32_t sizeIndex;		///< Position of the glyph's size in Key::fontSizes.
+		stbtt_packedchar geometry;
+	};
+
+	/// A validated cache entry; keeps the cache file mapped while it exists.
+	class Entry
+	{
+	public:
+
+		Entry(std::unique_ptr<MappedFile> file_);
+
+		const Glyph* GetGlyphs() const { return glyphs; }
+		uint32_t GetGlyphCount() const { return glyphCount; }
+
+		const KerningPair* GetKerningPairs() const { return kerningPairs; }
+		uint32_t GetKerningPairCount() const { return kerningPairCount; }
+
+		/// Atlas pixels (one byte per pixel), valid as long as the entry exists.
+		const uint8_t* GetPixels() const { return pixels; }
+		int GetWidth() const { return width; }
+		int GetHeight() const { return height; }
+		int GetPitch() const { return pitch; }
+
+	private:
+
+		std::unique_ptr<MappedFile> file;
+		const Glyph* glyphs = nullptr;
+		uint32_t glyphCount = 0;
+		const KerningPair* kerningPairs = nullptr;
+		uint32_t kerningPairCount = 0;
+		const uint8_t* pixels = nullptr;
+		int width = 0;
+		int height = 0;
+		int pitch = 0;
+	};
+
+	/**
+	 * Creates a cache that lives in the given directory.
+	 * The directory is created on the first Store() if it does not exist.
+	 */
+	AtlasCache(const std::string& directory_ = DefaultDirectory());
+
+	/// Returns $XDG_CACHE_HOME/sdlmessage, or ~/.cache/sdlmessage if XDG_CACHE_HOME is not set.
+	static std::string DefaultDirectory();
+
+	/**
+	 * Builds the cache key for the given fallback chain of font faces, sizes, charset mask, atlas mode and subpixel phases.
+	 * The identity fields describe the first font; the paths and identities of the
+	 * others are folded into fontPath and fontContentHash.
+	 */
+	static Key MakeKey(const std::vector<FontCollection::FaceRef>& fontFaces, const std::vector<float>& fontSizes,
+		uint32_t charsets, uint32_t atlasMode = 0, uint32_t subpixelPhases = 1);
+
+	/**
+	 * Looks up the entry for the key.
+	 * \return The mapped entry, or null if there is none or it is stale, truncated
+	 * or was written for a different key.
+	 */
+	std::unique_ptr<Entry> Load(const Key& key) const;
+
+	/**
+	 * Atomically writes (or replaces) the entry for the key.
+	 * \return True on success; on failure, SDL_Error is set and the cache is left as it was.
+	 */
+	bool Store(const Key& key, const std::vector<Glyph>& glyphs, const std::vector<KerningPair>& kerningPairs,
+		const uint8_t* pixels, int width, int height, int pitch) const;
+
+	const std::string& GetDirectory() const { return directory; }
+
+private:
+
+	/// Returns the path of the file that holds the entry for the key.
+	std::string GetEntryPath(const Key& key) const;
+
+	std::string directory;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+#include "stb_truetype.h"
+#include "Kerning.h"
+
+/**
+ * A glyph atlas that was packed at build time (by tools/BakeAtlas.cpp) and
+ * compiled into the executable, so that the most common case needs neither
+ * the font file nor rasterization at startup.
+ *
+ * Only the glyphs the font actually covers are included; codepoints that
+ * are not in codepoints[] have to come from a real font.
+ */
+struct BakedAtlas {
+	const char* fontPath;		///< The font the atlas was made from (for diagnostics only).
+	float fontSize;
+	uint32_t charsets;			///< Font::kCharset... mask the atlas was packed for.
+
+	uint32_t glyphCount;
+	const int32_t* codepoints;			///< Ascending.
+	const stbtt_packedchar* glyphs;	///< Geometry of the glyph of each codepoint.
+
+	uint32_t kerningPairCount;
+	const KerningPair* kerningPairs;
+
+	int width;
+	int height;
+	int pitch;
+	const uint8_t* pixels;		///< INDEX8 (gray level) atlas pixels.
+};
+
+/// Returns the atlas baked into the executable, or null if the build did not bake one.
+const BakedAtlas* GetBakedAtlas();
@@ -0,0 +1,119 @@
+#include "ByteSource.h"
+#include "MapFile.h"
+#include "SDL.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+/// Smallest amount of data read at once (and the initial size of the buffer).
+const size_t kReadChunkSize = 1 << 20;
+
+} // namespace
+
+//---
+
+std::unique_ptr<ByteSource> ByteSource::Open(const char* fileName, Access access)
+{
+	// only regular files with some contents can be mapped
+	struct stat fileMetadata;
+	if (strcmp(fileName, "-") != 0 && stat(fileName, &fileMetadata) == 0
+		&& S_ISREG(fileMetadata.st_mode) && fileMetadata.st_size > 0
+	) {
+		auto mappedFile = std::make_unique<MappedFile>(fileName, access);
+		if (mappedFile->Ok()) {
+			return mappedFile;
+		}
+	}
+	return std::make_unique<StreamedFile>(fileName);
+}
+
+//---
+
+StreamedFile::StreamedFile(const char* fileName_)
+	: ByteSource(fileName_)
+{
+	bool standardInput = (fileName == "-");
+	int f = standardInput ? STDIN_FILENO : open(fileName.c_str(), O_RDONLY);
+	if (f < 0) {
+		SDL_SetError("open() failed");
+		return;
+	}
+
+	struct stat fileMetadata;
+	if (fstat(f, &fileMetadata) != 0) {
+		SDL_SetError("fstat() failed");
+		if (!standardInput) close(f);
+		return;
+	}
+	device = fileMetadata.st_dev;
+	inode = fileMetadata.st_ino;
+	modificationTime = int64_t(fileMetadata.st_mtim.tv_sec) * 1000000000 + fileMetadata.st_mtim.tv_nsec;
+
+	// a size reported up front (regular files that could not be mapped) saves growing the buffer
+	size_t size = 0;
+	bool ok = Reserve(std::max(size_t(std::max<off_t>(fileMetadata.st_size, 0)) + 1, kReadChunkSize));
+	while (ok) {
+		if (capacity - size < kReadChunkSize && !Reserve(2 * capacity)) {
+			ok = false;
+			break;
+		}
+		ssize_t count = read(f, data + size, capacity - size);
+		if (count < 0 && errno == EINTR) continue;
+		if (count < 0) {
+			SDL_SetError("read() failed");
+			ok = false;
+		}
+		if (count <= 0) break;
+		size += count;
+	}
+	if (!standardInput) close(f);
+
+	if (ok && size == 0) {
+		SDL_SetError("file is empty");
+		ok = false;
+	}
+	if (!ok) {
+		Release();
+		return;
+	}
+	byteSize = size;
+}
+
+StreamedFile::~StreamedFile()
+{
+	Release();
+}
+
+void StreamedFile::Release()
+{
+	if (data) {
+		munmap(data, capacity);
+	}
+	data = nullptr;
+	byteSize = 0;
+	capacity = 0;
+}
+
+bool StreamedFile::Reserve(size_t minCapacity)
+{
+	if (minCapacity <= capacity) return true;
+
+	size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+	size_t newCapacity = (minCapacity + pageSize - 1) & ~(pageSize - 1);
+	void* mapping = data
+		? mremap(data, capacity, newCapacity, MREMAP_MAYMOVE)
+		: mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) {
+		SDL_SetError("out of memory for %s", fileName.c_str());
+		return false;
+	}
+	data = static_cast<uint8_t*>(mapping);
+	capacity = newCapacity;
+	return true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/**
+ * Read-only contents of a file held in memory as one contiguous block.
+ *
+ * Regular files are mapped (see MappedFile); anything that cannot be mapped,
+ * such as pipes, FIFOs, /proc files or standard input, is read to the end
+ * into memory instead. Either way, the data stays valid as long as the object exists.
+ */
+class ByteSource
+{
+public:
+
+	/// How the contents are going to be read; lets the kernel bring pages in before they are touched.
+	/// Only matters for mapped files (data that has been read in is all in memory anyway).
+	enum class Access {
+		kDefault,		///< Pages are read in on first touch (with the kernel's default read-ahead).
+		kPopulate,		///< The whole file is read in before the constructor returns (MAP_POPULATE).
+		kWillNeed,		///< Reading of the whole file starts in the background (MADV_WILLNEED).
+		kSequential,	///< Aggressive read-ahead, pages are dropped soon after use (MADV_SEQUENTIAL).
+		kRandom,		///< No read-ahead, only touched pages are read (MADV_RANDOM).
+
+		/**
+		 * The file is a TrueType/OpenType font (or collection): only the tables used
+		 * for rasterization and layout (cmap, loca, glyf, hmtx, kern, GPOS) are read
+		 * in, all at once, before the constructor returns; the rest is left alone.
+		 */
+		kFontTables
+	};
+
+	/**
+	 * Maps the file if it can be mapped, otherwise reads it in; "-" stands for standard input.
+	 * On error, the resulting object is invalid, and a terse error description
+	 * is stored using SDL_SetError().
+	 */
+	static std::unique_ptr<ByteSource> Open(const char* fileName, Access access = Access::kDefault);
+
+	ByteSource(const ByteSource& src) = delete;
+	virtual ~ByteSource() = default;
+
+	bool Ok() const { return (data != nullptr); }
+	uint8_t* GetData() { return data; }
+	const uint8_t* GetData() const { return data; }
+	size_t GetSize() const { return byteSize; }
+
+	/// Returns the name the file was opened with.
+	const std::string& GetFileName() const { return fileName; }
+
+	/// Returns true if the data is mapped from the file, so that it reflects the file
+	/// identified by the device, inode and modification time below.
+	virtual bool IsMapped() const = 0;
+
+	/// Device and inode numbers of the file, as reported by fstat() when it was opened.
+	uint64_t GetDevice() const { return device; }
+	uint64_t GetInode() const { return inode; }
+
+	/// Modification time of the file (nanoseconds since the epoch) at the time it was opened.
+	int64_t GetModificationTime() const { return modificationTime; }
+
+	/// Bytes of the data currently in memory.
+	virtual size_t GetResidentSize() const { return byteSize; }
+
+protected:
+
+	ByteSource(const char* fileName_) : fileName(fileName_) {}
+
+	uint8_t* data = nullptr;
+	size_t byteSize = 0;
+	std::string fileName;
+	uint64_t device = 0;
+	uint64_t inode = 0;
+	int64_t modificationTime = 0;
+};
+
+/**
+ * Contents of a file or stream that has been read to the end.
+ *
+ * The data is read in large chunks straight into an anonymous mapping that
+ * grows with mremap() (which moves pages instead of copying them), so reading
+ * any amount of data copies every byte just once, from the kernel.
+ */
+class StreamedFile : public ByteSource
+{
+public:
+
+	/// Reads the file, or standard input if the name is "-".
+	StreamedFile(const char* fileName);
+
+	~StreamedFile();
+
+	bool IsMapped() const override { return false; }
+
+private:
+
+	/// Makes room for at least minCapacity bytes.
+	bool Reserve(size_t minCapacity);
+
+	/// Frees the buffer, invalidating the object.
+	void Release();
+
+	size_t capacity = 0;
+};
@@ -0,0 +1,29 @@
+#include "CodepointTable.h"
+
+CodepointTable::CodepointTable()
+{
+	Clear();
+}
+
+void CodepointTable::Set(uint32_t codepoint, uint32_t value)
+{
+	if (codepoint >= kCodepointLimit) return;
+
+	uint16_t& pageNumber = directory[codepoint / kPageSize];
+	if (pageNumber == 0) {
+		if (value == 0) return;		// nothing to remove
+
+		// first use of this block: give it its own page
+		pages.emplace_back();
+		pages.back().fill(0);
+		pageNumber = uint16_t(pages.size() - 1);
+	}
+	pages[pageNumber][codepoint % kPageSize] = value;
+}
+
+void CodepointTable::Clear()
+{
+	directory.fill(0);
+	pages.assign(1, Page());
+	pages[0].fill(0);
+}
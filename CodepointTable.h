@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+
+/**
+ * Sparse map from Unicode codepoints (all 17 planes) to 32-bit values,
+ * where 0 means "no value".
+ *
+ * Two levels: a directory indexed by the upper bits of the codepoint holds
+ * page numbers, and each page holds the values of 256 consecutive codepoints.
+ * Pages are allocated only for blocks that are actually used; all other
+ * directory entries refer to a shared page of zeros, so a lookup is two
+ * dependent loads regardless of how many blocks are in use.
+ *
+ * The directory costs ~8.5 kB, each used page 1 kB; a Latin-only font
+ * typically touches three pages.
+ */
+class CodepointTable
+{
+public:
+
+	static const uint32_t kCodepointLimit = 0x110000;
+	static const uint32_t kPageSize = 256;
+
+	CodepointTable();
+
+	/// Returns the value stored for the codepoint, or 0 if there is none.
+	uint32_t Get(uint32_t codepoint) const
+	{
+		// out-of-range codepoints all land in the (empty) page 0
+		uint32_t page = (codepoint < kCodepointLimit) ? directory[codepoint / kPageSize] : 0;
+		return pages[page][codepoint % kPageSize];
+	}
+
+	/// Stores a value for the codepoint (0 removes it); out-of-range codepoints are ignored.
+	void Set(uint32_t codepoint, uint32_t value);
+
+	/// Removes all values and releases the pages.
+	void Clear();
+
+	/// Number of allocated pages (not counting the shared empty one).
+	size_t GetPageCount() const { return pages.size() - 1; }
+
+	/// Calls fn(codepoint, value) for every codepoint that has a value, in ascending order.
+	template<class Fn>
+	void ForEach(Fn fn) const
+	{
+		for (uint32_t block = 0; block < directory.size(); block++) {
+			if (directory[block] == 0) continue;
+			const Page& page = pages[directory[block]];
+			for (uint32_t i = 0; i < kPageSize; i++) {
+				if (page[i]) {
+					fn(block * kPageSize + i, page[i]);
+				}
+			}
+		}
+	}
+
+private:
+
+	using Page = std::array<uint32_t, kPageSize>;
+
+	/// Page number for each block of 256 codepoints; 0 is the shared empty page.
+	std::array<uint16_t, kCodepointLimit / kPageSize> directory;
+
+	std::vector<Page> pages;
+};
@@ -0,0 +1,249 @@
+#include "CoverageBlend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COVERAGEBLEND_X86 1
+#endif
+
+namespace {
+
+struct BlendKernel {
+	CoverageBlend::RowFunction blendRow;
+	const char* name;
+};
+
+/// Every channel of dest moved towards the pixel by a/255: (d*(255 - a) + f*a)/255, rounded
+/// (x/255 as (x + 128 + ((x + 128) >> 8)) >> 8, exact for any x up to 255*255).
+inline uint32_t BlendPixel(uint32_t dest, uint32_t pixel, uint32_t a)
+{
+	uint32_t result = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		uint32_t d = (dest >> shift) & 0xff;
+		uint32_t f = (pixel >> shift) & 0xff;
+		uint32_t x = d * (255 - a) + f * a + 128;
+		result |= ((x + (x >> 8)) >> 8) << shift;
+	}
+	return result;
+}
+
+#ifdef COVERAGEBLEND_X86
+
+/// BlendPixel() of the channels in 16-bit lanes (the products fit as unsigned, and so do the sums).
+__attribute__((target("sse2"), always_inline))
+inline __m128i BlendChannels(__m128i dest, __m128i color, __m128i weights)
+{
+	__m128i x = _mm_add_epi16(_mm_mullo_epi16(dest, _mm_sub_epi16(_mm_set1_epi16(255), weights)),
+		_mm_mullo_epi16(color, weights));
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2"), always_inline))
+inline __m256i BlendChannels(__m256i dest, __m256i color, __m256i weights)
+{
+	__m256i x = _mm256_add_epi16(_mm256_mullo_epi16(dest, _mm256_sub_epi16(_mm256_set1_epi16(255), weights)),
+		_mm256_mullo_epi16(color, weights));
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+/// Four pixels blended by four bytes of coverage (the first in the low byte); color16 is the pixel in 16-bit lanes.
+__attribute__((target("sse2"), always_inline))
+inline __m128i BlendFour(__m128i pixels, uint32_t four, __m128i color16)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	// every weight repeated over the four channels of its pixel
+	__m128i weights = _mm_cvtsi32_si128(int32_t(four));
+	weights = _mm_unpacklo_epi8(weights, weights);
+	weights = _mm_unpacklo_epi16(weights, weights);
+
+	__m128i low = BlendChannels(_mm_unpacklo_epi8(pixels, zero), color16, _mm_unpacklo_epi8(weights, zero));
+	__m128i high = BlendChannels(_mm_unpackhi_epi8(pixels, zero), color16, _mm_unpackhi_epi8(weights, zero));
+	return _mm_packus_epi16(low, high);
+}
+
+/// The last one to three pixels of a row, as four with the missing ones covered by nothing
+/// (gathered into registers, as going through a buffer in memory stalls on store forwarding).
+__attribute__((target("sse2"), always_inline))
+inline void BlendTail(const uint8_t* coverage, uint32_t* dest, int count, __m128i color16)
+{
+	uint32_t four = coverage[0];
+	__m128i pixels = _mm_cvtsi32_si128(int32_t(dest[0]));
+	if (count > 1) {
+		four |= uint32_t(coverage[1]) << 8;
+		pixels = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(dest));
+	}
+	if (count > 2) {
+		four |= uint32_t(coverage[2]) << 16;
+		pixels = _mm_unpacklo_epi64(pixels, _mm_cvtsi32_si128(int32_t(dest[2])));
+	}
+
+	__m128i blended = BlendFour(pixels, four, color16);
+	if (count > 1) {
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dest), blended);
+	}
+	else {
+		dest[0] = uint32_t(_mm_cvtsi128_si32(blended));
+	}
+	if (count > 2) {
+		dest[2] = uint32_t(_mm_cvtsi128_si32(_mm_unpackhi_epi64(blended, blended)));
+	}
+}
+
+__attribute__((target("sse2")))
+void BlendRowSse2(const uint8_t* coverage, uint32_t* dest, int count, uint32_t pixel)
+{
+	const __m128i color16 = _mm_unpacklo_epi8(_mm_set1_epi32(int32_t(pixel)), _mm_setzero_si128());
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		uint32_t four;
+		memcpy(&four, coverage + i, 4);
+		__m128i* out = reinterpret_cast<__m128i*>(dest + i);
+		_mm_storeu_si128(out, BlendFour(_mm_loadu_si128(out), four, color16));
+	}
+	if (i < count) {
+		BlendTail(coverage + i, dest + i, count - i, color16);
+	}
+}
+
+__attribute__((target("avx2")))
+void BlendRowAvx2(const uint8_t* coverage, uint32_t* dest, int count, uint32_t pixel)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i color = _mm256_set1_epi32(int32_t(pixel));
+	const __m256i color16 = _mm256_unpacklo_epi8(color, zero);
+
+	// no shortcuts for empty or solid blocks: in glyph rows they alternate with edges too often
+	// for the branches to be predicted, and a misprediction costs more than blending the block
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i* out = reinterpret_cast<__m256i*>(dest + i);
+
+		// weights of pixels 0-3 in the low lane and 4-7 in the high one, as the pixels are;
+		// unpacking and packing stay within lanes, so the order comes out right
+		__m128i weights = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(coverage + i));
+		weights = _mm_unpacklo_epi8(weights, weights);
+		__m256i spread = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(weights, weights)),
+			_mm_unpackhi_epi16(weights, weights), 1);
+
+		__m256i pixels = _mm256_loadu_si256(out);
+		__m256i low = BlendChannels(_mm256_unpacklo_epi8(pixels, zero), color16, _mm256_unpacklo_epi8(spread, zero));
+		__m256i high = BlendChannels(_mm256_unpackhi_epi8(pixels, zero), color16, _mm256_unpackhi_epi8(spread, zero));
+		_mm256_storeu_si256(out, _mm256_packus_epi16(low, high));
+	}
+
+	// glyph rows are short, so their ends matter (inlined, with VEX encoded instructions)
+	const __m128i color16Half = _mm256_castsi256_si128(color16);
+	if (i + 4 <= count) {
+		uint32_t four;
+		memcpy(&four, coverage + i, 4);
+		__m128i* out = reinterpret_cast<__m128i*>(dest + i);
+		_mm_storeu_si128(out, BlendFour(_mm_loadu_si128(out), four, color16Half));
+		i += 4;
+	}
+	if (i < count) {
+		BlendTail(coverage + i, dest + i, count - i, color16Half);
+	}
+
+	// GCC does not clear the upper halves itself in a function of another target, and the SSE code
+	// of the caller would then pay for the state transition with every instruction
+	_mm256_zeroupper();
+}
+
+#endif
+
+BlendKernel SelectBlendKernel()
+{
+#ifdef COVERAGEBLEND_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return BlendKernel { BlendRowAvx2, "avx2" };
+#ifdef __SSE2__
+	return BlendKernel { BlendRowSse2, "sse2" };
+#else
+	if (__builtin_cpu_supports("sse2")) return BlendKernel { BlendRowSse2, "sse2" };
+#endif
+#endif
+	return BlendKernel { CoverageBlend::BlendRowScalar, "scalar" };
+}
+
+const BlendKernel& GetBlendKernel()
+{
+	static const BlendKernel kernel = SelectBlendKernel();
+	return kernel;
+}
+
+/// Relative luminance of a color whose channels are encoded with the given gamma.
+float LinearLuminance(SDL_Color color, float gamma)
+{
+	auto linear = [gamma](uint8_t channel) { return std::pow(channel / 255.0f, gamma); };
+	return 0.2126f * linear(color.r) + 0.7152f * linear(color.g) + 0.0722f * linear(color.b);
+}
+
+} // namespace
+
+CoverageBlend::CoverageBlend(const SDL_PixelFormat* format, SDL_Color foreground)
+{
+	blendRow = GetBlendKernel().blendRow;
+	pixel = SDL_MapRGBA(format, foreground.r, foreground.g, foreground.b, 0xff);
+	adjusted = (foreground.a != 0xff);
+	for (int c = 0; c < 256; c++) {
+		coverageTable[c] = uint8_t((c * foreground.a + 127) / 255);
+	}
+}
+
+CoverageBlend::CoverageBlend(const SDL_PixelFormat* format, SDL_Color foreground, SDL_Color background, float gamma)
+	: CoverageBlend(format, foreground)
+{
+	if (gamma <= 0.0f) return;
+
+	// the encoded luminance of the blend goes from the background's to the foreground's;
+	// coverage is mapped to where on that way linear blending would end up
+	float foregroundLuminance = LinearLuminance(foreground, gamma);
+	float backgroundLuminance = LinearLuminance(background, gamma);
+	float from = std::pow(backgroundLuminance, 1.0f / gamma);
+	float to = std::pow(foregroundLuminance, 1.0f / gamma);
+	if (std::fabs(to - from) < 1.0f / 255.0f) return;
+
+	for (int c = 0; c < 256; c++) {
+		float weight = c / 255.0f * foreground.a / 255.0f;
+		float luminance = backgroundLuminance + (foregroundLuminance - backgroundLuminance) * weight;
+		float corrected = (std::pow(luminance, 1.0f / gamma) - from) / (to - from);
+		coverageTable[c] = uint8_t(std::lround(std::clamp(corrected, 0.0f, 1.0f) * 255.0f));
+	}
+	adjusted = true;
+}
+
+void CoverageBlend::BlendRow(const uint8_t* coverage, uint32_t* dest, int count) const
+{
+	if (!adjusted) {
+		blendRow(coverage, dest, count, pixel);
+		return;
+	}
+
+	uint8_t mapped[256];
+	for (int done = 0; done < count; done += int(sizeof(mapped))) {
+		int chunk = std::min(count - done, int(sizeof(mapped)));
+		for (int i = 0; i < chunk; i++) {
+			mapped[i] = coverageTable[coverage[done + i]];
+		}
+		blendRow(mapped, dest + done, chunk, pixel);
+	}
+}
+
+void CoverageBlend::BlendRowScalar(const uint8_t* coverage, uint32_t* dest, int count, uint32_t pixel)
+{
+	for (int i = 0; i < count; i++) {
+		if (coverage[i] == 0) continue;
+		dest[i] = BlendPixel(dest[i], pixel, coverage[i]);
+	}
+}
+
+const char* CoverageBlend::GetKernelName()
+{
+	return GetBlendKernel().name;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+#include "SDLWrapper.h"
+
+/**
+ * Blends a foreground color over 32-bit pixels (any format of four 8-bit
+ * channels), each pixel weighted by its coverage from a glyph image:
+ * dest = dest + (foreground - dest) * coverage / 255 in every channel, rounded
+ * to nearest. Unlike blitting the gray atlas, this keeps the destination
+ * where the coverage is 0, so overlapping glyph boxes do not wipe each other
+ * out, and the text can have any color over any background.
+ *
+ * Coverage is linear in light, but blending in the encoded (sRGB-like) values
+ * of the pixels makes light text on a dark background too thin and dark text
+ * on a light one too bold. With a background given, coverage goes through a
+ * table that makes the blend of the foreground over that background come out
+ * at the luminance that linear blending would give.
+ *
+ * Rows are blended with SSE2 or AVX2, chosen for the CPU at run time,
+ * and give exactly the same pixels as BlendRowScalar().
+ */
+class CoverageBlend
+{
+public:
+
+	/// Plain blending of the foreground (whose alpha scales the coverage) into the given format.
+	CoverageBlend(const SDL_PixelFormat* format, SDL_Color foreground);
+
+	/// Gamma-correct blending of the foreground over the given background, for a display of the given gamma.
+	CoverageBlend(const SDL_PixelFormat* format, SDL_Color foreground, SDL_Color background, float gamma);
+
+	/// Blends the foreground over count pixels, by the coverage (0 to 255) of each.
+	void BlendRow(const uint8_t* coverage, uint32_t* dest, int count) const;
+
+	/// The foreground as an opaque pixel of the format.
+	uint32_t GetPixel() const { return pixel; }
+
+	/// True if coverage goes through a table (gamma correction, or a translucent foreground).
+	bool IsAdjusted() const { return adjusted; }
+
+	/// Reference blend of a pixel by coverage, without any coverage table.
+	static void BlendRowScalar(const uint8_t* coverage, uint32_t* dest, int count, uint32_t pixel);
+
+	/// Name of the row kernel chosen for this CPU ("avx2", "sse2" or "scalar").
+	static const char* GetKernelName();
+
+	/// Blends count pixels by their coverage (a row kernel).
+	using RowFunction = void (*)(const uint8_t* coverage, uint32_t* dest, int count, uint32_t pixel);
+
+private:
+
+	RowFunction blendRow;
+	uint32_t pixel;
+	bool adjusted = false;
+	uint8_t coverageTable[256];
+};
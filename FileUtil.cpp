@@ -0,0 +1,78 @@
+#include "FileUtil.h"
+#include "SDL.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+/// Writes the whole buffer, retrying on short writes.
+bool WriteAll(int fd, const void* data, size_t byteCount)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	while (byteCount > 0) {
+		ssize_t written = write(fd, p, byteCount);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		p += written;
+		byteCount -= written;
+	}
+	return true;
+}
+
+} // namespace
+
+bool MakeDirectories(const std::string& path)
+{
+	for (size_t i = 1; i <= path.size(); i++) {
+		if (i == path.size() || path[i] == '/') {
+			std::string prefix = path.substr(0, i);
+			if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+				SDL_SetError("could not create directory %s", prefix.c_str());
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool WriteFileAtomically(const std::string& path, const std::vector<WriteBlock>& blocks)
+{
+	// mkstemp() picks a name no other writer uses (nor a file left behind by one that crashed)
+	std::string tempPath = path + ".tmp.XXXXXX";
+	int f = mkstemp(&tempPath[0]);
+	if (f < 0) {
+		SDL_SetError("could not create %s", tempPath.c_str());
+		return false;
+	}
+
+	// mkstemp() creates the file as 0600, the written file gets the usual 0644
+	bool written = (fchmod(f, 0644) == 0);
+	for (const WriteBlock& block : blocks) {
+		written = written && WriteAll(f, block.data, block.byteCount);
+	}
+	if (close(f) != 0) {
+		written = false;
+	}
+	if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+		SDL_SetError("could not write %s", path.c_str());
+		unlink(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+int64_t GetModificationTime(const std::string& path)
+{
+	struct stat metadata;
+	if (stat(path.c_str(), &metadata) != 0) {
+		return -1;
+	}
+	return int64_t(metadata.st_mtim.tv_sec) * 1000000000 + metadata.st_mtim.tv_nsec;
+}
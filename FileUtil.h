@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// A block of memory to be written out by WriteFileAtomically().
+struct WriteBlock {
+	const void* data;
+	size_t byteCount;
+};
+
+/// Creates the directory and all its missing parents (like mkdir -p).
+bool MakeDirectories(const std::string& path);
+
+/**
+ * Writes the blocks, one after another, to a temporary file next to the target
+ * and renames it over the target, so that readers see either the old or the
+ * complete new contents, never a partial file.
+ * \return True on success; on failure, SDL_Error is set and the target is untouched.
+ */
+bool WriteFileAtomically(const std::string& path, const std::vector<WriteBlock>& blocks);
+
+/// Returns the modification time of the file or directory in nanoseconds since the epoch, or -1 if it does not exist.
+int64_t GetModificationTime(const std::string& path);
@@ -0,0 +1,67 @@
+#include "FontCollection.h"
+#include "SDL.h"
+
+namespace {
+
+uint16_t ReadU16(const uint8_t* p) { return uint16_t((p[0] << 8) | p[1]); }
+uint32_t ReadU32(const uint8_t* p) { return (uint32_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+/// True if the table directory at the offset, and the start of every table it lists, lie within the file.
+bool IsDirectoryInFile(const uint8_t* data, size_t size, uint32_t offset)
+{
+	if (uint64_t(offset) + 12 > size) return false;
+	uint16_t tableCount = ReadU16(data + offset + 4);
+	if (uint64_t(offset) + 12 + 16 * uint64_t(tableCount) > size) return false;
+	for (uint16_t i = 0; i < tableCount; i++) {
+		const uint8_t* record = data + offset + 12 + 16 * i;
+		if (ReadU32(record + 8) >= size) return false;
+	}
+	return true;
+}
+
+} // namespace
+
+FontCollection::FontCollection(const ByteSource& file_)
+	: file(file_)
+{
+	const uint8_t* data = file.GetData();
+	size_t size = file.GetSize();
+	if (!data || size < 12) return;
+
+	// stb_truetype trusts the header and the table directories, so the face count, the offsets
+	// and the directories are checked against the size here (a plain font has a face count of 1
+	// and needs more than 16 bytes for its directory anyway)
+	int faceCount = stbtt_GetNumberOfFonts(data);
+	if (faceCount <= 0 || 12 + 4 * uint64_t(faceCount) > size) return;
+	for (int i = 0; i < faceCount; i++) {
+		int offset = stbtt_GetFontOffsetForIndex(data, i);
+		if (offset < 0 || !IsDirectoryInFile(data, size, uint32_t(offset))) {
+			faceOffsets.clear();
+			return;
+		}
+		faceOffsets.push_back(uint32_t(offset));
+	}
+	faces.resize(faceCount);
+}
+
+const FontCollection::Face* FontCollection::GetFace(int index) const
+{
+	if (index < 0 || index >= GetFaceCount()) {
+		SDL_SetError("%s has no face #%d", file.GetFileName().c_str(), index);
+		return nullptr;
+	}
+	if (!faces[index]) {
+		stbtt_fontinfo info;
+		if (!stbtt_InitFont(&info, file.GetData(), faceOffsets[index])) {
+			SDL_SetError("stbtt_InitFont() failed for face #%d of %s", index, file.GetFileName().c_str());
+			return nullptr;
+		}
+		std::vector<CodepointRange> coverage;
+		if (!ReadCoverage(info, file.GetSize(), coverage)) {
+			SDL_SetError("The cmap of face #%d of %s is cut off", index, file.GetFileName().c_str());
+			return nullptr;
+		}
+		faces[index] = std::make_unique<Face>(Face { info, CoverageBitset(coverage) });
+	}
+	return faces[index].get();
+}
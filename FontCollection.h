@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ByteSource.h"
+#include "FontCoverage.h"
+
+#include "stb_truetype.h"
+
+/**
+ * The faces of a font file: a single one for a plain font,
+ * any number of them for a collection (.ttc/.otc).
+ *
+ * The face table is read once, when the collection is created; the faces
+ * themselves are only set up (and their coverage read) when first asked for,
+ * so a collection with dozens of faces costs nothing for the faces not used.
+ * The file must stay in memory for the lifetime of the collection.
+ * Not thread-safe.
+ */
+class FontCollection
+{
+public:
+
+	/// A face that is ready for rendering.
+	struct Face {
+		stbtt_fontinfo info;
+		CoverageBitset coverage;
+	};
+
+	/// Refers to a face of a collection, e.g. as a link of a fallback chain.
+	struct FaceRef {
+		FaceRef(const FontCollection* collection_, int index_ = 0) : collection(collection_), index(index_) {}
+
+		const FontCollection* collection;
+		int index;
+	};
+
+	explicit FontCollection(const ByteSource& file_);
+
+	FontCollection(const FontCollection& src) = delete;
+
+	/// Returns true if the file is a font or a font collection.
+	bool Ok() const { return !faceOffsets.empty(); }
+
+	int GetFaceCount() const { return int(faceOffsets.size()); }
+
+	/// Byte offset of the face's table directory in the file.
+	uint32_t GetFaceOffset(int index) const { return faceOffsets[index]; }
+
+	/**
+	 * Returns the face, setting it up on first use.
+	 * \return Null, with SDL_Error set, if there is no such face or it is broken.
+	 */
+	const Face* GetFace(int index) const;
+
+	const ByteSource& GetFile() const { return file; }
+
+private:
+
+	const ByteSource& file;
+	std::vector<uint32_t> faceOffsets;
+	mutable std::vector<std::unique_ptr<Face>> faces;
+};
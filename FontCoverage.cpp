@@ -0,0 +1,204 @@
+#include "FontCoverage.h"
+
+#include <algorithm>
+
+namespace {
+
+uint16_t ReadU16(const uint8_t* p) { return uint16_t((p[0] << 8) | p[1]); }
+uint32_t ReadU32(const uint8_t* p) { return (uint32_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+/// True if the given number of bytes at p lie before end.
+bool Fits(const uint8_t* p, uint64_t bytes, const uint8_t* end) { return p <= end && bytes <= uint64_t(end - p); }
+
+/// Collects codepoints into ranges; codepoints must be added in ascending order.
+class RangeBuilder
+{
+public:
+
+	void Add(uint32_t first, uint32_t last)
+	{
+		if (!ranges.empty() && first <= ranges.back().last + 1) {
+			ranges.back().last = std::max(ranges.back().last, last);
+		}
+		else {
+			ranges.push_back(CodepointRange { first, last });
+		}
+	}
+
+	std::vector<CodepointRange> ranges;
+};
+
+bool ReadFormat4(const uint8_t* table, const uint8_t* end, RangeBuilder& builder)
+{
+	if (!Fits(table, 14, end)) return false;
+	uint16_t segCount = ReadU16(table + 6) / 2;
+	const uint8_t* endCodes = table + 14;
+	const uint8_t* startCodes = endCodes + 2 * segCount + 2;
+	const uint8_t* idDeltas = startCodes + 2 * segCount;
+	const uint8_t* idRangeOffsets = idDeltas + 2 * segCount;
+	if (!Fits(table, 16 + 8 * uint64_t(segCount), end)) return false;
+
+	for (uint16_t seg = 0; seg < segCount; seg++) {
+		uint32_t start = ReadU16(startCodes + 2 * seg);
+		uint32_t last = ReadU16(endCodes + 2 * seg);
+		uint16_t delta = ReadU16(idDeltas + 2 * seg);
+		uint16_t rangeOffset = ReadU16(idRangeOffsets + 2 * seg);
+		if (start > last) continue;
+		if (last == 0xffff) {
+			if (start == 0xffff) continue;	// the mandatory terminating segment
+			last = 0xfffe;
+		}
+
+		const uint8_t* glyphs = idRangeOffsets + 2 * seg + rangeOffset;
+		if (rangeOffset != 0 && !Fits(glyphs, 2 * uint64_t(last - start + 1), end)) return false;
+
+		for (uint32_t c = start; c <= last; c++) {
+			uint16_t glyph;
+			if (rangeOffset == 0) {
+				glyph = uint16_t(c + delta);
+			}
+			else {
+				glyph = ReadU16(glyphs + 2 * (c - start));
+				if (glyph != 0) glyph = uint16_t(glyph + delta);
+			}
+			if (glyph != 0) builder.Add(c, c);
+		}
+	}
+	return true;
+}
+
+/// Format 12 maps groups to consecutive glyphs, format 13 (many-to-one) maps a whole group to one glyph.
+bool ReadFormat12(const uint8_t* table, const uint8_t* end, bool manyToOne, RangeBuilder& builder)
+{
+	if (!Fits(table, 16, end)) return false;
+	uint32_t groupCount = ReadU32(table + 12);
+	if (!Fits(table, 16 + 12 * uint64_t(groupCount), end)) return false;
+	for (uint32_t i = 0; i < groupCount; i++) {
+		const uint8_t* group = table + 16 + 12 * i;
+		uint32_t first = ReadU32(group);
+		uint32_t last = std::min(ReadU32(group + 4), uint32_t(0x10ffff));
+		uint32_t firstGlyph = ReadU32(group + 8);
+		if (firstGlyph == 0) {
+			if (manyToOne) continue;	// the whole group maps to .notdef
+			first++;	// only the first codepoint maps to .notdef
+		}
+		if (first <= last) builder.Add(first, last);
+	}
+	return true;
+}
+
+/// End of the cmap subtable at table, from its length field clamped to the end of the file (or null if even that is cut off).
+const uint8_t* GetSubtableEnd(const uint8_t* table, uint16_t format, const uint8_t* dataEnd)
+{
+	uint64_t length;
+	if (format == 8 || format == 10 || format == 12 || format == 13) {
+		if (!Fits(table, 8, dataEnd)) return nullptr;
+		length = ReadU32(table + 4);
+	}
+	else if (format == 14) {
+		if (!Fits(table, 6, dataEnd)) return nullptr;
+		length = ReadU32(table + 2);
+	}
+	else {
+		length = ReadU16(table + 2);
+	}
+	return table + std::min(length, uint64_t(dataEnd - table));
+}
+
+} // namespace
+
+bool ReadCoverage(const stbtt_fontinfo& font, size_t dataSize, std::vector<CodepointRange>& coverage)
+{
+	if (font.index_map <= 0 || uint64_t(font.index_map) + 4 > dataSize) return false;
+	const uint8_t* table = font.data + font.index_map;
+	uint16_t format = ReadU16(table);
+	const uint8_t* end = GetSubtableEnd(table, format, font.data + dataSize);
+	if (!end) return false;
+
+	RangeBuilder builder;
+	if (format == 0) {
+		if (!Fits(table, 6 + 256, end)) return false;
+		for (uint32_t c = 0; c < 256; c++) {
+			if (table[6 + c] != 0) builder.Add(c, c);
+		}
+	}
+	else if (format == 4) {
+		if (!ReadFormat4(table, end, builder)) return false;
+	}
+	else if (format == 6) {
+		if (!Fits(table, 10, end)) return false;
+		uint16_t first = ReadU16(table + 6);
+		uint16_t count = ReadU16(table + 8);
+		if (!Fits(table, 10 + 2 * uint64_t(count), end) || first + count > 0x10000) return false;
+		for (uint16_t i = 0; i < count; i++) {
+			if (ReadU16(table + 10 + 2 * i) != 0) builder.Add(first + i, first + i);
+		}
+	}
+	else if (format == 12 || format == 13) {
+		if (!ReadFormat12(table, end, format == 13, builder)) return false;
+	}
+	else {
+		for (uint32_t c = 0; c < 0x10000; c++) {
+			if (stbtt_FindGlyphIndex(&font, c) != 0) builder.Add(c, c);
+		}
+	}
+
+	// segments are sorted in all formats, but be defensive about broken fonts
+	std::sort(builder.ranges.begin(), builder.ranges.end(), [](const CodepointRange& a, const CodepointRange& b) {
+		return a.first < b.first;
+	});
+	RangeBuilder merged;
+	for (const CodepointRange& range : builder.ranges) {
+		merged.Add(range.first, range.last);
+	}
+	coverage = std::move(merged.ranges);
+	return true;
+}
+
+bool RangesContain(const CodepointRange* ranges, size_t rangeCount, uint32_t codepoint)
+{
+	// find the last range that starts at or before the codepoint
+	const CodepointRange* end = ranges + rangeCount;
+	const CodepointRange* found = std::upper_bound(ranges, end, codepoint, [](uint32_t c, const CodepointRange& range) {
+		return c < range.first;
+	});
+	if (found == ranges) return false;
+	return codepoint <= (found - 1)->last;
+}
+
+//---
+
+CoverageBitset::CoverageBitset(const std::vector<CodepointRange>& ranges)
+{
+	directory.fill(0);
+	pages.resize(2);
+	pages[0].fill(0);
+	pages[1].fill(~uint64_t(0));
+
+	for (const CodepointRange& range : ranges) {
+		uint32_t last = std::min(range.last, kCodepointLimit - 1);
+		for (uint32_t c = range.first; c <= last; ) {
+			uint32_t block = c / kPageBits;
+			uint32_t blockEnd = (block + 1) * kPageBits - 1;
+
+			// a block covered as a whole needs no page of its own
+			if (directory[block] == 1
+				|| (c % kPageBits == 0 && last >= blockEnd && directory[block] == 0)
+			) {
+				directory[block] = 1;
+				c = blockEnd + 1;
+				continue;
+			}
+			if (directory[block] == 0) {
+				pages.emplace_back();
+				pages.back().fill(0);
+				directory[block] = uint16_t(pages.size() - 1);
+			}
+			Page& page = pages[directory[block]];
+			uint32_t end = std::min(last, blockEnd);
+			for (; c <= end; c++) {
+				page[(c % kPageBits) / 64] |= uint64_t(1) << (c % 64);
+			}
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+
+#include "stb_truetype.h"
+
+/// An inclusive range of codepoints.
+struct CodepointRange {
+	uint32_t first;
+	uint32_t last;
+};
+
+/**
+ * Reads which codepoints the font maps to a glyph, using the cmap subtable
+ * that stbtt_InitFont() picked. Formats 0, 4, 6, 12 and 13 are decoded directly;
+ * for anything else every BMP codepoint is looked up with stbtt_FindGlyphIndex().
+ * Counts and offsets are checked against the subtable's length, clamped to
+ * dataSize (the size of the font file that font.data points into).
+ * \param coverage Receives sorted, non-overlapping and non-adjacent ranges.
+ * \return False if the subtable is cut off or points outside itself.
+ */
+bool ReadCoverage(const stbtt_fontinfo& font, size_t dataSize, std::vector<CodepointRange>& coverage);
+
+/// Returns true if the codepoint lies in one of the (sorted) ranges.
+bool RangesContain(const CodepointRange* ranges, size_t rangeCount, uint32_t codepoint);
+
+/**
+ * Set of codepoints covered by a font, for answering "does this font have
+ * a glyph for c" with a directory load and a single bit test.
+ *
+ * Pages of 4096 bits are allocated only for blocks that are partly covered;
+ * blocks that are entirely covered or entirely missing share two constant
+ * pages, so a font with a few scripts costs a couple of kilobytes.
+ */
+class CoverageBitset
+{
+public:
+
+	static const uint32_t kCodepointLimit = 0x110000;
+	static const uint32_t kPageBits = 4096;
+
+	CoverageBitset(const std::vector<CodepointRange>& ranges);
+
+	bool Contains(uint32_t codepoint) const
+	{
+		// out-of-range codepoints all land in the empty page 0
+		uint32_t page = (codepoint < kCodepointLimit) ? directory[codepoint / kPageBits] : 0;
+		uint32_t bit = codepoint % kPageBits;
+		return (pages[page][bit / 64] >> (bit % 64)) & 1;
+	}
+
+	/// Number of allocated pages (not counting the shared empty and full ones).
+	size_t GetPageCount() const { return pages.size() - 2; }
+
+private:
+
+	using Page = std::array<uint64_t, kPageBits / 64>;
+
+	/// Page number for each block of codepoints; 0 is the empty page, 1 the full one.
+	std::array<uint16_t, kCodepointLimit / kPageBits> directory;
+
+	std::vector<Page> pages;
+};
@@ -0,0 +1,448 @@
+#include "FontIndex.h"
+#include "AtlasCache.h"
+#include "FileUtil.h"
+#include "FontCollection.h"
+#include "SDL.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <set>
+#include <utility>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+namespace {
+
+const char kMagic[8] = { 'S', 'D', 'L', 'M', 'F', 'I', 'D', 'X' };
+const uint32_t kFormatVersion = 1;
+
+/// Layout of the index file: the header, then the directories, faces, ranges and the string pool.
+struct IndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t rootCount;			///< The first rootCount directories are the ones the scan started from.
+	uint32_t directoryCount;
+	uint32_t faceCount;
+	uint32_t rangeCount;
+	uint32_t stringBytes;
+};
+
+struct DirectoryRecord {
+	uint32_t pathOffset;
+	uint32_t reserved;
+	int64_t modificationTime;	///< -1 if the directory did not exist.
+};
+
+struct FaceRecord {
+	uint32_t pathOffset;
+	uint32_t familyOffset;
+	uint32_t styleOffset;
+	uint32_t faceIndex;
+	uint32_t firstRange;
+	uint32_t rangeCount;
+};
+
+/// Pointers into the sections of an index in memory.
+struct IndexView {
+	const IndexHeader* header;
+	const DirectoryRecord* directories;
+	const FaceRecord* faces;
+	const CodepointRange* ranges;
+	const char* strings;
+
+	IndexView(const uint8_t* data)
+	{
+		header = reinterpret_cast<const IndexHeader*>(data);
+		directories = reinterpret_cast<const DirectoryRecord*>(header + 1);
+		faces = reinterpret_cast<const FaceRecord*>(directories + header->directoryCount);
+		ranges = reinterpret_cast<const CodepointRange*>(faces + header->faceCount);
+		strings = reinterpret_cast<const char*>(ranges + header->rangeCount);
+	}
+};
+
+uint64_t ExpectedIndexSize(const IndexHeader& header)
+{
+	return sizeof(IndexHeader)
+		+ uint64_t(header.directoryCount) * sizeof(DirectoryRecord)
+		+ uint64_t(header.faceCount) * sizeof(FaceRecord)
+		+ uint64_t(header.rangeCount) * sizeof(CodepointRange)
+		+ header.stringBytes;
+}
+
+bool IsFontFileName(const char* name)
+{
+	const char* dot = strrchr(name, '.');
+	return dot && (strcasecmp(dot, ".ttf") == 0 || strcasecmp(dot, ".otf") == 0 || strcasecmp(dot, ".ttc") == 0);
+}
+
+bool IsRegularStyle(const char* style)
+{
+	return strcasecmp(style, "Regular") == 0 || strcasecmp(style, "Book") == 0
+		|| strcasecmp(style, "Normal") == 0 || strcasecmp(style, "Roman") == 0;
+}
+
+/// Converts a big-endian UTF-16 string (as found in the name table) to UTF-8.
+std::string Utf16BeToUtf8(const char* source, int byteCount)
+{
+	std::string result;
+	const uint8_t* p = reinterpret_cast<const uint8_t*>(source);
+	for (int i = 0; i + 1 < byteCount; i += 2) {
+		uint32_t c = (p[i] << 8) | p[i + 1];
+		if (c >= 0xd800 && c < 0xdc00 && i + 3 < byteCount) {
+			uint32_t low = (p[i + 2] << 8) | p[i + 3];
+			c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+			i += 2;
+		}
+		if (c < 0x80) {
+			result += char(c);
+		}
+		else if (c < 0x800) {
+			result += char(0xc0 | (c >> 6));
+			result += char(0x80 | (c & 0x3f));
+		}
+		else if (c < 0x10000) {
+			result += char(0xe0 | (c >> 12));
+			result += char(0x80 | ((c >> 6) & 0x3f));
+			result += char(0x80 | (c & 0x3f));
+		}
+		else {
+			result += char(0xf0 | (c >> 18));
+			result += char(0x80 | ((c >> 12) & 0x3f));
+			result += char(0x80 | ((c >> 6) & 0x3f));
+			result += char(0x80 | (c & 0x3f));
+		}
+	}
+	return result;
+}
+
+/// Reads an English name from the name table; empty if there is none.
+std::string GetFontName(const stbtt_fontinfo& font, int nameId)
+{
+	int length = 0;
+	const char* name = stbtt_GetFontNameString(&font, &length,
+		STBTT_PLATFORM_ID_MICROSOFT, STBTT_MS_EID_UNICODE_BMP, STBTT_MS_LANG_ENGLISH, nameId);
+	if (name) {
+		return Utf16BeToUtf8(name, length);
+	}
+	name = stbtt_GetFontNameString(&font, &length,
+		STBTT_PLATFORM_ID_MAC, STBTT_MAC_EID_ROMAN, STBTT_MAC_LANG_ENGLISH, nameId);
+	if (name) {
+		return std::string(name, length);
+	}
+	return std::string();
+}
+
+/// Accumulates the contents of the index while scanning.
+class IndexBuilder
+{
+public:
+
+	uint32_t AddString(const std::string& s)
+	{
+		uint32_t offset = strings.size();
+		strings.insert(strings.end(), s.begin(), s.end());
+		strings.push_back('\0');
+		return offset;
+	}
+
+	void AddDirectory(const std::string& path, int64_t modificationTime)
+	{
+		directories.push_back(DirectoryRecord { AddString(path), 0, modificationTime });
+	}
+
+	/// Records every face in the font file.
+	void AddFontFile(const std::string& path)
+	{
+		MappedFile fontFile(path.c_str());
+		if (!fontFile.Ok()) return;
+
+		// the collection checks the header and table directories that stb_truetype trusts
+		FontCollection collection(fontFile);
+		for (int faceIndex = 0; faceIndex < collection.GetFaceCount(); faceIndex++) {
+			stbtt_fontinfo font;
+			if (!stbtt_InitFont(&font, fontFile.GetData(), int(collection.GetFaceOffset(faceIndex)))) continue;
+
+			// prefer the typographic family (which groups widths and weights) over the legacy one
+			std::string family = GetFontName(font, 16);
+			if (family.empty()) family = GetFontName(font, 1);
+			std::string style = GetFontName(font, 17);
+			if (style.empty()) style = GetFontName(font, 2);
+			if (family.empty()) continue;
+
+			// a broken cmap would make the coverage of the face meaningless, so the face is left out
+			std::vector<CodepointRange> coverage;
+			if (!ReadCoverage(font, fontFile.GetSize(), coverage)) continue;
+			faces.push_back(FaceRecord {
+				.pathOffset = AddString(path),
+				.familyOffset = AddString(family),
+				.styleOffset = AddString(style),
+				.faceIndex = uint32_t(faceIndex),
+				.firstRange = uint32_t(ranges.size()),
+				.rangeCount = uint32_t(coverage.size())
+			});
+			ranges.insert(ranges.end(), coverage.begin(), coverage.end());
+		}
+	}
+
+	/// Records the directory and descends into it, indexing all font files.
+	void ScanDirectory(const std::string& path)
+	{
+		struct stat metadata;
+		if (stat(path.c_str(), &metadata) != 0 || !S_ISDIR(metadata.st_mode)) return;
+
+		// guard against symlink loops
+		if (!visited.insert(std::make_pair(uint64_t(metadata.st_dev), uint64_t(metadata.st_ino))).second) return;
+
+		AddDirectory(path, int64_t(metadata.st_mtim.tv_sec) * 1000000000 + metadata.st_mtim.tv_nsec);
+		ScanContents(path);
+	}
+
+	/// Indexes all font files in the directory and its subdirectories.
+	void ScanContents(const std::string& path)
+	{
+		DIR* dir = opendir(path.c_str());
+		if (!dir) return;
+		std::vector<std::string> names;
+		while (dirent* entry = readdir(dir)) {
+			if (entry->d_name[0] != '.') {
+				names.push_back(entry->d_name);
+			}
+		}
+		closedir(dir);
+
+		// sorted, so that rebuilding an unchanged tree gives the same index
+		std::sort(names.begin(), names.end());
+		for (const std::string& name : names) {
+			std::string childPath = path + "/" + name;
+			struct stat metadata;
+			if (stat(childPath.c_str(), &metadata) != 0) continue;
+			if (S_ISDIR(metadata.st_mode)) {
+				ScanDirectory(childPath);
+			}
+			else if (S_ISREG(metadata.st_mode) && IsFontFileName(name.c_str())) {
+				AddFontFile(childPath);
+			}
+		}
+	}
+
+	std::vector<DirectoryRecord> directories;
+	std::vector<FaceRecord> faces;
+	std::vector<CodepointRange> ranges;
+	std::vector<char> strings;
+	std::set<std::pair<uint64_t, uint64_t>> visited;
+};
+
+} // namespace
+
+//---
+
+FontIndex::FontIndex(const std::vector<std::string>& fontDirectories, const std::string& indexPath_)
+	: indexPath(indexPath_)
+{
+	file = std::make_unique<MappedFile>(indexPath.c_str());
+	if (file->Ok() && IsValid(file->GetData(), file->GetSize(), fontDirectories)) {
+		data = file->GetData();
+		byteSize = file->GetSize();
+		return;
+	}
+	file.reset();
+
+	Build(fontDirectories);
+	rebuilt = true;
+	data = buildBuffer.data();
+	byteSize = buildBuffer.size();
+
+	// a read-only cache directory only means that the next run has to scan again
+	size_t slash = indexPath.rfind('/');
+	if (slash != std::string::npos && slash > 0) {
+		MakeDirectories(indexPath.substr(0, slash));
+	}
+	WriteFileAtomically(indexPath, { { buildBuffer.data(), buildBuffer.size() } });
+}
+
+//---
+
+std::vector<std::string> FontIndex::DefaultFontDirectories()
+{
+	std::vector<std::string> result = {
+		"/usr/share/fonts",
+		"/usr/local/share/fonts"
+	};
+	const char* xdgDataHome = getenv("XDG_DATA_HOME");
+	const char* home = getenv("HOME");
+	if (xdgDataHome && xdgDataHome[0] == '/') {
+		result.push_back(std::string(xdgDataHome) + "/fonts");
+	}
+	else if (home && home[0]) {
+		result.push_back(std::string(home) + "/.local/share/fonts");
+	}
+	if (home && home[0]) {
+		result.push_back(std::string(home) + "/.fonts");
+	}
+	return result;
+}
+
+//---
+
+std::string FontIndex::DefaultIndexPath()
+{
+	return AtlasCache::DefaultDirectory() + "/fonts.idx";
+}
+
+//---
+
+bool FontIndex::IsValid(const uint8_t* indexData, size_t indexSize, const std::vector<std::string>& fontDirectories) const
+{
+	if (indexSize < sizeof(IndexHeader)) return false;
+	const IndexHeader* header = reinterpret_cast<const IndexHeader*>(indexData);
+	if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0
+		|| header->version != kFormatVersion
+		|| ExpectedIndexSize(*header) != indexSize
+		|| header->stringBytes == 0
+		|| header->rootCount != fontDirectories.size()
+		|| header->rootCount > header->directoryCount
+	) {
+		return false;
+	}
+
+	IndexView view(indexData);
+	if (view.strings[header->stringBytes - 1] != '\0') return false;
+	for (uint32_t i = 0; i < header->directoryCount; i++) {
+		if (view.directories[i].pathOffset >= header->stringBytes) return false;
+	}
+	for (uint32_t i = 0; i < header->faceCount; i++) {
+		const FaceRecord& face = view.faces[i];
+		if (face.pathOffset >= header->stringBytes
+			|| face.familyOffset >= header->stringBytes
+			|| face.styleOffset >= header->stringBytes
+			|| uint64_t(face.firstRange) + face.rangeCount > header->rangeCount
+		) {
+			return false;
+		}
+	}
+
+	// the index must have been built from the same directories...
+	for (uint32_t i = 0; i < header->rootCount; i++) {
+		if (fontDirectories[i] != view.strings + view.directories[i].pathOffset) return false;
+	}
+
+	// ...and none of them may have changed since (adding or removing a file changes the mtime of its directory)
+	for (uint32_t i = 0; i < header->directoryCount; i++) {
+		const DirectoryRecord& directory = view.directories[i];
+		if (GetModificationTime(view.strings + directory.pathOffset) != directory.modificationTime) return false;
+	}
+	return true;
+}
+
+//---
+
+void FontIndex::Build(const std::vector<std::string>& fontDirectories)
+{
+	IndexBuilder builder;
+
+	// the roots come first, including the missing ones (so that creating them invalidates the index)
+	for (const std::string& directory : fontDirectories) {
+		builder.AddDirectory(directory, GetModificationTime(directory));
+	}
+	for (const std::string& directory : fontDirectories) {
+		struct stat metadata;
+		if (stat(directory.c_str(), &metadata) != 0 || !S_ISDIR(metadata.st_mode)) continue;
+		if (builder.visited.insert(std::make_pair(uint64_t(metadata.st_dev), uint64_t(metadata.st_ino))).second) {
+			builder.ScanContents(directory);
+		}
+	}
+	if (builder.strings.empty()) {
+		builder.AddString("");
+	}
+
+	IndexHeader header = { 0 };
+	memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kFormatVersion;
+	header.rootCount = fontDirectories.size();
+	header.directoryCount = builder.directories.size();
+	header.faceCount = builder.faces.size();
+	header.rangeCount = builder.ranges.size();
+	header.stringBytes = builder.strings.size();
+
+	buildBuffer.resize(ExpectedIndexSize(header));
+	uint8_t* p = buildBuffer.data();
+	auto append = [&p](const void* source, size_t byteCount) {
+		memcpy(p, source, byteCount);
+		p += byteCount;
+	};
+	append(&header, sizeof(header));
+	append(builder.directories.data(), builder.directories.size() * sizeof(DirectoryRecord));
+	append(builder.faces.data(), builder.faces.size() * sizeof(FaceRecord));
+	append(builder.ranges.data(), builder.ranges.size() * sizeof(CodepointRange));
+	append(builder.strings.data(), builder.strings.size());
+}
+
+//---
+
+size_t FontIndex::GetFaceCount() const
+{
+	return data ? reinterpret_cast<const IndexHeader*>(data)->faceCount : 0;
+}
+
+//---
+
+FontIndex::Face FontIndex::GetFace(size_t i) const
+{
+	IndexView view(data);
+	const FaceRecord& record = view.faces[i];
+
+	Face face;
+	face.path = view.strings + record.pathOffset;
+	face.faceIndex = record.faceIndex;
+	face.family = view.strings + record.familyOffset;
+	face.style = view.strings + record.styleOffset;
+	face.ranges = view.ranges + record.firstRange;
+	face.rangeCount = record.rangeCount;
+	return face;
+}
+
+//---
+
+bool FontIndex::FindByFamily(const std::string& family, Face& result) const
+{
+	bool found = false;
+	for (size_t i = 0; i < GetFaceCount(); i++) {
+		Face face = GetFace(i);
+		if (strcasecmp(face.family, family.c_str()) != 0) continue;
+		if (!found || (IsRegularStyle(face.style) && !IsRegularStyle(result.style))) {
+			result = face;
+			found = true;
+		}
+	}
+	return found;
+}
+
+//---
+
+bool FontIndex::FindByCoverage(const std::wstring& text, Face& result) const
+{
+	std::vector<uint32_t> codepoints;
+	for (wchar_t c : text) {
+		codepoints.push_back(uint32_t(c));
+	}
+	std::sort(codepoints.begin(), codepoints.end());
+	codepoints.erase(std::unique(codepoints.begin(), codepoints.end()), codepoints.end());
+
+	// coverage counts most, the regular style only breaks ties
+	int bestScore = 0;
+	for (size_t i = 0; i < GetFaceCount(); i++) {
+		Face face = GetFace(i);
+		int covered = 0;
+		for (uint32_t c : codepoints) {
+			if (face.Covers(c)) covered++;
+		}
+		int score = covered * 2 + (IsRegularStyle(face.style) ? 1 : 0);
+		if (covered > 0 && score > bestScore) {
+			bestScore = score;
+			result = face;
+		}
+	}
+	return bestScore > 0;
+}
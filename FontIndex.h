@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <vector>
+
+#include "MapFile.h"
+#include "FontCoverage.h"
+
+/**
+ * Index of the fonts installed on the system.
+ *
+ * The font directories are scanned once; for every face, the file path,
+ * family and style names and the cmap coverage are stored in a compact
+ * binary index file that later runs simply map into memory. The index
+ * records the modification time of every directory it scanned and is
+ * rebuilt as soon as any of them changes (which is what happens when
+ * fonts are installed or removed).
+ */
+class FontIndex
+{
+public:
+
+	/// One face as recorded in the index; the pointers are valid as long as the index exists.
+	struct Face {
+		const char* path = nullptr;
+		int faceIndex = 0;			///< Index of the face within a collection (.ttc), 0 otherwise.
+		const char* family = nullptr;
+		const char* style = nullptr;
+		const CodepointRange* ranges = nullptr;	///< Codepoints covered by the face.
+		size_t rangeCount = 0;
+
+		bool Covers(uint32_t codepoint) const { return RangesContain(ranges, rangeCount, codepoint); }
+	};
+
+	/**
+	 * Opens the index, rebuilding it first if it is missing or out of date.
+	 * Failing to write the rebuilt index is not an error; it is then kept in memory only.
+	 */
+	FontIndex(const std::vector<std::string>& fontDirectories = DefaultFontDirectories(),
+		const std::string& indexPath_ = DefaultIndexPath());
+
+	FontIndex(const FontIndex& src) = delete;
+
+	bool Ok() const { return data != nullptr; }
+
+	/// Returns true if the directories had to be scanned during construction.
+	bool WasRebuilt() const { return rebuilt; }
+
+	/// The usual system and per-user font directories.
+	static std::vector<std::string> DefaultFontDirectories();
+
+	/// Returns the index file location (in the same directory as the atlas cache).
+	static std::string DefaultIndexPath();
+
+	size_t GetFaceCount() const;
+	Face GetFace(size_t i) const;
+
+	/**
+	 * Finds a face of the family (case-insensitive), preferring the regular style.
+	 * \return True if there is one.
+	 */
+	bool FindByFamily(const std::string& family, Face& result) const;
+
+	/**
+	 * Finds the face that covers most of the characters of the text,
+	 * preferring regular styles among equally good ones.
+	 * \return True if some face covers at least one of the characters.
+	 */
+	bool FindByCoverage(const std::wstring& text, Face& result) const;
+
+private:
+
+	/// Checks that the mapped or built index is consistent and up to date.
+	bool IsValid(const uint8_t* indexData, size_t indexSize, const std::vector<std::string>& fontDirectories) const;
+
+	/// Scans the directories and serializes the result into buildBuffer.
+	void Build(const std::vector<std::string>& fontDirectories);
+
+	std::string indexPath;
+	bool rebuilt = false;
+
+	std::unique_ptr<MappedFile> file;
+	std::vector<uint8_t> buildBuffer;
+
+	const uint8_t* data = nullptr;
+	size_t byteSize = 0;
+};
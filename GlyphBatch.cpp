@@ -0,0 +1,111 @@
+#include "GlyphBatch.h"
+
+GlyphBatch::GlyphBatch(SDL_Renderer* renderer_, Font& font_)
+	: renderer(renderer_), font(font_)
+{
+	UploadAtlas();
+}
+
+bool GlyphBatch::UploadAtlas()
+{
+	atlasTexture.reset();
+	atlasVersion = font.GetAtlasVersion();
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	if (font.GetAtlasMode() != Font::AtlasMode::kCoverage) {
+		SDL_SetError("Glyph batches need a coverage atlas");
+		return false;
+	}
+
+	// the coverage goes into alpha, so that the vertex color tints the glyphs and they blend over anything
+	SDL::Surface& atlas = font.GetSurface();
+	SDL::Surface coverage(atlas.GetWidth(), atlas.GetHeight(), 32, SDL_PIXELFORMAT_RGBA32);
+	if (!coverage.Ok()) return false;
+	for (int y = 0; y < atlas.GetHeight(); y++) {
+		const uint8_t* source = static_cast<const uint8_t*>(atlas.GetPixels()) + y * atlas.GetPitch();
+		uint8_t* row = static_cast<uint8_t*>(coverage.GetPixels()) + y * coverage.GetPitch();
+		for (int x = 0; x < atlas.GetWidth(); x++) {
+
+			// RGBA32 is R, G, B, A in memory order
+			row[4 * x] = row[4 * x + 1] = row[4 * x + 2] = 255;
+			row[4 * x + 3] = source[x];
+		}
+	}
+
+	atlasTexture = std::make_unique<SDL::Texture>(renderer, coverage);
+	if (!atlasTexture->Ok()) return false;
+	SDL_SetTextureBlendMode(*atlasTexture, SDL_BLENDMODE_BLEND);
+
+	// glyphs are drawn 1:1 at whole pixels unless oversampled
+	bool filtered = (font.GetSubpixelPhases() > 1);
+	SDL_SetTextureScaleMode(*atlasTexture, filtered ? SDL_ScaleModeLinear : SDL_ScaleModeNearest);
+
+	atlasWidth = float(atlas.GetWidth());
+	atlasHeight = float(atlas.GetHeight());
+	return true;
+#else
+	SDL_SetError("Glyph batches need SDL 2.0.18 or later");
+	return false;
+#endif
+}
+
+void GlyphBatch::Clear()
+{
+	vertices.clear();
+	indices.clear();
+}
+
+void GlyphBatch::AddGlyph(const GlyphRun& run, const PositionedGlyph& glyph, int32_t penX, int baselineY,
+	SDL_Color color)
+{
+	const stbtt_packedchar& g = glyph.geometry;
+	if (g.x1 <= g.x0 || g.y1 <= g.y0) return;
+
+	// an atlas glyph drawn as it is lands on whole pixels, exactly as a blit would put it
+	float left, top, right, bottom;
+	if (run.scale == 1.0f && font.GetSubpixelPhases() == 1) {
+		left = float(PenToNearestPixel(penX)) + g.xoff;
+		top = float(baselineY) + g.yoff;
+		right = left + (g.x1 - g.x0);
+		bottom = top + (g.y1 - g.y0);
+	}
+	else {
+		left = PenToPixels(penX) + g.xoff * run.scale;
+		top = baselineY + g.yoff * run.scale;
+		right = PenToPixels(penX) + g.xoff2 * run.scale;
+		bottom = baselineY + g.yoff2 * run.scale;
+	}
+
+	// texture coordinates stay in atlas pixels until Draw(), as a lazy atlas may grow in between
+	float u0 = g.x0, v0 = g.y0;
+	float u1 = g.x1, v1 = g.y1;
+
+	int first = int(vertices.size());
+	vertices.push_back(SDL_Vertex { { left, top }, color, { u0, v0 } });
+	vertices.push_back(SDL_Vertex { { right, top }, color, { u1, v0 } });
+	vertices.push_back(SDL_Vertex { { left, bottom }, color, { u0, v1 } });
+	vertices.push_back(SDL_Vertex { { right, bottom }, color, { u1, v1 } });
+	for (int corner : { 0, 1, 2, 2, 1, 3 }) {
+		indices.push_back(first + corner);
+	}
+}
+
+bool GlyphBatch::Draw()
+{
+	if (font.GetAtlasVersion() != atlasVersion && !UploadAtlas()) return false;
+	if (!Ok()) return false;
+	if (vertices.empty()) return true;
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	// normalized by the size of the atlas just uploaded
+	drawnVertices.assign(vertices.begin(), vertices.end());
+	for (SDL_Vertex& vertex : drawnVertices) {
+		vertex.tex_coord.x /= atlasWidth;
+		vertex.tex_coord.y /= atlasHeight;
+	}
+	return 0 == SDL_RenderGeometry(renderer, *atlasTexture, drawnVertices.data(), int(drawnVertices.size()),
+		indices.data(), int(indices.size()));
+#else
+	return false;
+#endif
+}
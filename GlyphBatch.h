@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "SDLWrapper.h"
+#include "TextLayout.h"
+
+/**
+ * Draws glyphs straight from the atlas on the GPU (or with SDL's software renderer):
+ * the atlas is uploaded once as a texture whose alpha is the glyph coverage, and
+ * every glyph added becomes a textured, colored quad of one vertex/index batch,
+ * drawn with a single SDL_RenderGeometry() call. Changing the text only means
+ * filling the batch again; the atlas is uploaded again only when it changes
+ * (a lazy font that adds glyphs).
+ *
+ * Coverage atlases only (distance fields need thresholding that the renderer
+ * cannot do); glyphs at fractional positions, subpixel phases and scales other
+ * than 1 are filtered bilinearly, as stb_truetype's oversampling intends.
+ * Needs SDL 2.0.18 or later.
+ */
+class GlyphBatch
+{
+public:
+
+	/// The font must outlive the batch.
+	GlyphBatch(SDL_Renderer* renderer_, Font& font_);
+
+	GlyphBatch(const GlyphBatch& src) = delete;
+
+	/// True if the atlas could be uploaded (false, with SDL_Error set, otherwise).
+	bool Ok() const { return atlasTexture && atlasTexture->Ok(); }
+
+	/// Removes all glyphs.
+	void Clear();
+
+	/**
+	 * Adds the glyph (as laid out in the run) with its origin at (penX, baselineY),
+	 * penX being in 1/64 pixels (26.6 fixed point).
+	 */
+	void AddGlyph(const GlyphRun& run, const PositionedGlyph& glyph, int32_t penX, int baselineY, SDL_Color color);
+
+	int GetGlyphCount() const { return int(vertices.size() / 4); }
+
+	/// Draws all glyphs in one call (uploading the atlas first if it has changed).
+	bool Draw();
+
+private:
+
+	/// Creates the atlas texture: white, with the coverage as alpha.
+	bool UploadAtlas();
+
+	SDL_Renderer* renderer;
+	Font& font;
+
+	std::unique_ptr<SDL::Texture> atlasTexture;
+	int atlasVersion = -1;
+	float atlasWidth = 1.0f;
+	float atlasHeight = 1.0f;
+
+	/// Quads with texture coordinates in atlas pixels.
+	std::vector<SDL_Vertex> vertices;
+	std::vector<int> indices;
+
+	/// The quads as drawn, with texture coordinates normalized to the atlas.
+	std::vector<SDL_Vertex> drawnVertices;
+};
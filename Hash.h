@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/// Initial value for HashBytes() (the FNV-1a 64-bit offset basis).
+const uint64_t kHashSeed = 0xcbf29ce484222325ull;
+
+/**
+ * Computes a 64-bit FNV-1a hash of a block of memory.
+ * Pass the result of a previous call as the seed to hash several blocks as one.
+ * Not cryptographic; good enough for cache keys and hash tables.
+ */
+inline uint64_t HashBytes(const void* data, size_t byteCount, uint64_t seed = kHashSeed)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < byteCount; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
@@ -0,0 +1,413 @@
+#include "Kerning.h"
+
+#include <algorithm>
+
+namespace {
+
+uint16_t ReadU16(const uint8_t* p) { return uint16_t((p[0] << 8) | p[1]); }
+int16_t ReadS16(const uint8_t* p) { return int16_t(ReadU16(p)); }
+
+/// Index of the glyph in an OpenType coverage table, or -1.
+int CoverageIndex(const uint8_t* coverage, int glyph)
+{
+	uint16_t format = ReadU16(coverage);
+	if (format == 1) {
+		int count = ReadU16(coverage + 2);
+		const uint8_t* glyphs = coverage + 4;
+		int l = 0, r = count - 1;
+		while (l <= r) {
+			int m = (l + r) / 2;
+			int value = ReadU16(glyphs + 2 * m);
+			if (glyph < value) r = m - 1;
+			else if (glyph > value) l = m + 1;
+			else return m;
+		}
+	}
+	else if (format == 2) {
+		int count = ReadU16(coverage + 2);
+		const uint8_t* records = coverage + 4;
+		int l = 0, r = count - 1;
+		while (l <= r) {
+			int m = (l + r) / 2;
+			const uint8_t* record = records + 6 * m;
+			if (glyph < ReadU16(record)) r = m - 1;
+			else if (glyph > ReadU16(record + 2)) l = m + 1;
+			else return ReadU16(record + 4) + glyph - ReadU16(record);
+		}
+	}
+	return -1;
+}
+
+/// Class of the glyph in an OpenType class definition table; -1 for glyphs that are not listed (as stb_truetype does).
+int GlyphClass(const uint8_t* classDef, int glyph)
+{
+	uint16_t format = ReadU16(classDef);
+	if (format == 1) {
+		int start = ReadU16(classDef + 2);
+		int count = ReadU16(classDef + 4);
+		if (glyph >= start && glyph < start + count) {
+			return ReadU16(classDef + 6 + 2 * (glyph - start));
+		}
+	}
+	else if (format == 2) {
+		int count = ReadU16(classDef + 2);
+		const uint8_t* records = classDef + 4;
+		int l = 0, r = count - 1;
+		while (l <= r) {
+			int m = (l + r) / 2;
+			const uint8_t* record = records + 6 * m;
+			if (glyph < ReadU16(record)) r = m - 1;
+			else if (glyph > ReadU16(record + 2)) l = m + 1;
+			else return ReadU16(record + 4);
+		}
+	}
+	return -1;
+}
+
+/// Where each glyph id occurs in a list of glyphs (a glyph may be listed more than once).
+class GlyphListIndex
+{
+public:
+
+	GlyphListIndex(const std::vector<int>& glyphs, int glyphCount)
+		: positions(std::max(glyphCount, 0), -1)
+	{
+		for (size_t i = 0; i < glyphs.size(); i++) {
+			if (glyphs[i] < 0 || glyphs[i] >= glyphCount) continue;
+			if (positions[glyphs[i]] < 0) {
+				positions[glyphs[i]] = int(i);
+			}
+			else {
+				// the index above finds only one of them
+				duplicates.resize(glyphs.size());
+				duplicates[positions[glyphs[i]]].push_back(int(i));
+			}
+		}
+	}
+
+	/// Calls fn with every position of the glyph in the list.
+	template<class Fn>
+	void ForEach(int glyph, Fn fn) const
+	{
+		if (glyph < 0 || glyph >= int(positions.size()) || positions[glyph] < 0) return;
+		fn(positions[glyph]);
+		if (!duplicates.empty()) {
+			for (int i : duplicates[positions[glyph]]) fn(i);
+		}
+	}
+
+private:
+
+	std::vector<int> positions;
+	std::vector<std::vector<int>> duplicates;
+};
+
+/**
+ * GPOS kerning of the pairs that involve a new glyph. stb_truetype takes the value
+ * of the first pair adjustment subtable that has an entry for the pair (even a zero
+ * one), in lookup order, so for every first glyph the subtables that cover it are
+ * collected, and each candidate pair gets its value from the first of them that
+ * lists the second glyph. Candidates are the pairs that a subtable gives a non-zero
+ * value for a new first glyph (found by walking its pair set or class row), and the
+ * pairs of an old first glyph with each new second one; the work grows with the pairs
+ * and the new glyphs, never with the square of all glyphs.
+ */
+class GposReader
+{
+public:
+
+	GposReader(const std::vector<int>& glyphs_, size_t firstNew_, const GlyphListIndex& listIndex_)
+		: glyphs(glyphs_), count(glyphs_.size()), firstNew(firstNew_), listIndex(listIndex_)
+	{
+	}
+
+	void Read(const uint8_t* gpos)
+	{
+		if (ReadU16(gpos) != 1 || ReadU16(gpos + 2) != 0) return;	// version 1.0 only
+
+		const uint8_t* lookupList = gpos + ReadU16(gpos + 8);
+		int lookupCount = ReadU16(lookupList);
+		for (int i = 0; i < lookupCount; i++) {
+			const uint8_t* lookup = lookupList + ReadU16(lookupList + 2 + 2 * i);
+			if (ReadU16(lookup) != 2) continue;		// pair adjustment
+
+			int subtableCount = ReadU16(lookup + 4);
+			for (int j = 0; j < subtableCount; j++) {
+				AddSubtable(lookup + ReadU16(lookup + 6 + 2 * j));
+			}
+		}
+		if (subtables.empty()) return;
+
+		std::vector<Match> matches;
+		std::vector<int> candidates;
+		for (size_t first = 0; first < count; first++) {
+			FindMatches(glyphs[first], matches);
+			if (matches.empty()) continue;
+
+			candidates.clear();
+			if (first >= firstNew) {
+				AddCandidates(matches, candidates);
+			}
+			else {
+				for (size_t second = firstNew; second < count; second++) {
+					candidates.push_back(int(second));
+				}
+			}
+
+			for (int second : candidates) {
+				int advance = Decide(matches, second);
+				if (advance != 0) {
+					pairs.push_back(GlyphKerning { int(first), second, advance });
+				}
+			}
+		}
+	}
+
+	std::vector<GlyphKerning> pairs;
+
+private:
+
+	struct Subtable {
+		const uint8_t* table;
+		uint16_t format;
+		const uint8_t* coverage;
+		bool supported;		///< Only x advances of the first glyph, as stb_truetype; any other pair gets 0.
+
+		// format 2 only
+		const uint8_t* classDef1 = nullptr;
+		int class1Count = 0;
+		int class2Count = 0;
+		std::vector<int> secondClasses;					///< Class 2 of every glyph of the list (-1 if it has none).
+		std::vector<std::vector<int>> secondsByClass;	///< Glyphs of the list by class 2.
+	};
+
+	/// A subtable that covers a first glyph, with what the glyph selects in it.
+	struct Match {
+		const Subtable* subtable;
+		const uint8_t* entries;		///< The pair set (format 1) or the class row (format 2).
+	};
+
+	void AddSubtable(const uint8_t* table)
+	{
+		uint16_t format = ReadU16(table);
+		if (format != 1 && format != 2) return;
+
+		Subtable subtable;
+		subtable.table = table;
+		subtable.format = format;
+		subtable.coverage = table + ReadU16(table + 2);
+		subtable.supported = (ReadU16(table + 4) == 4 && ReadU16(table + 6) == 0);
+		if (format == 2 && subtable.supported) {
+			const uint8_t* classDef2 = table + ReadU16(table + 10);
+			subtable.classDef1 = table + ReadU16(table + 8);
+			subtable.class1Count = ReadU16(table + 12);
+			subtable.class2Count = ReadU16(table + 14);
+			subtable.secondClasses.resize(count);
+			subtable.secondsByClass.resize(subtable.class2Count);
+			for (size_t second = 0; second < count; second++) {
+				int secondClass = GlyphClass(classDef2, glyphs[second]);
+				if (secondClass >= subtable.class2Count) secondClass = -1;
+				subtable.secondClasses[second] = secondClass;
+				if (secondClass >= 0) {
+					subtable.secondsByClass[secondClass].push_back(int(second));
+				}
+			}
+		}
+		subtables.push_back(std::move(subtable));
+	}
+
+	/// The subtables that decide pairs with the glyph first, in order.
+	void FindMatches(int glyph, std::vector<Match>& matches) const
+	{
+		matches.clear();
+		for (const Subtable& subtable : subtables) {
+			int coverageIndex = CoverageIndex(subtable.coverage, glyph);
+			if (coverageIndex < 0) continue;
+			if (!subtable.supported) {
+				// decides every remaining pair (as 0), so no later subtable matters
+				matches.push_back(Match { &subtable, nullptr });
+				return;
+			}
+
+			if (subtable.format == 1) {
+				// pair set of the first glyph: (second glyph, x advance) sorted by glyph
+				matches.push_back(Match { &subtable, subtable.table + ReadU16(subtable.table + 10 + 2 * coverageIndex) });
+			}
+			else {
+				int firstClass = GlyphClass(subtable.classDef1, glyph);
+				if (firstClass < 0 || firstClass >= subtable.class1Count) continue;
+				matches.push_back(Match { &subtable, subtable.table + 16 + 2 * firstClass * subtable.class2Count });
+			}
+		}
+	}
+
+	/// Adds the second glyphs that some matching subtable gives a non-zero advance, each once.
+	void AddCandidates(const std::vector<Match>& matches, std::vector<int>& candidates) const
+	{
+		for (const Match& match : matches) {
+			const Subtable& subtable = *match.subtable;
+			if (!match.entries) break;
+
+			if (subtable.format == 1) {
+				int pairCount = ReadU16(match.entries);
+				for (int m = 0; m < pairCount; m++) {
+					if (ReadS16(match.entries + 4 + 4 * m) == 0) continue;
+					listIndex.ForEach(ReadU16(match.entries + 2 + 4 * m), [&candidates](int second) {
+						candidates.push_back(second);
+					});
+				}
+			}
+			else {
+				for (int secondClass = 0; secondClass < subtable.class2Count; secondClass++) {
+					if (ReadS16(match.entries + 2 * secondClass) == 0) continue;
+					const std::vector<int>& seconds = subtable.secondsByClass[secondClass];
+					candidates.insert(candidates.end(), seconds.begin(), seconds.end());
+				}
+			}
+		}
+		std::sort(candidates.begin(), candidates.end());
+		candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+	}
+
+	/// The advance of the pair from the first matching subtable that lists the second glyph.
+	int Decide(const std::vector<Match>& matches, int second) const
+	{
+		for (const Match& match : matches) {
+			const Subtable& subtable = *match.subtable;
+			if (!match.entries) return 0;
+
+			if (subtable.format == 1) {
+				int pairCount = ReadU16(match.entries);
+				int l = 0, r = pairCount - 1;
+				while (l <= r) {
+					int m = (l + r) / 2;
+					int value = ReadU16(match.entries + 2 + 4 * m);
+					if (glyphs[second] < value) r = m - 1;
+					else if (glyphs[second] > value) l = m + 1;
+					else return ReadS16(match.entries + 4 + 4 * m);
+				}
+			}
+			else {
+				int secondClass = subtable.secondClasses[second];
+				if (secondClass >= 0) return ReadS16(match.entries + 2 * secondClass);
+			}
+		}
+		return 0;
+	}
+
+	const std::vector<int>& glyphs;
+	size_t count;
+	size_t firstNew;
+	const GlyphListIndex& listIndex;
+	std::vector<Subtable> subtables;
+};
+
+} // namespace
+
+std::vector<GlyphKerning> ReadKerning(const stbtt_fontinfo& font, const std::vector<int>& glyphs, size_t firstNew)
+{
+	std::vector<GlyphKerning> pairs;
+	if (firstNew >= glyphs.size()) return pairs;
+	GlyphListIndex listIndex(glyphs, font.numGlyphs);
+
+	if (font.gpos) {
+		GposReader reader(glyphs, firstNew, listIndex);
+		reader.Read(font.data + font.gpos);
+		pairs = std::move(reader.pairs);
+	}
+
+	// the first 'kern' subtable, if it is horizontal and format 0, lists (left, right, value) triples
+	const uint8_t* kern = font.kern ? font.data + font.kern : nullptr;
+	if (kern && ReadU16(kern + 2) >= 1 && ReadU16(kern + 8) == 1) {
+		int pairCount = ReadU16(kern + 10);
+		for (int i = 0; i < pairCount; i++) {
+			const uint8_t* record = kern + 18 + 6 * i;
+			int advance = ReadS16(record + 4);
+			if (advance == 0) continue;
+			listIndex.ForEach(ReadU16(record), [&](int first) {
+				listIndex.ForEach(ReadU16(record + 2), [&](int second) {
+					if (size_t(first) >= firstNew || size_t(second) >= firstNew) {
+						pairs.push_back(GlyphKerning { first, second, advance });
+					}
+				});
+			});
+		}
+	}
+
+	// the GPOS and 'kern' values of a pair add up
+	std::sort(pairs.begin(), pairs.end(), [](const GlyphKerning& a, const GlyphKerning& b) {
+		return a.first < b.first || (a.first == b.first && a.second < b.second);
+	});
+	std::vector<GlyphKerning> merged;
+	for (const GlyphKerning& pair : pairs) {
+		if (!merged.empty() && merged.back().first == pair.first && merged.back().second == pair.second) {
+			merged.back().advance += pair.advance;
+		}
+		else {
+			merged.push_back(pair);
+		}
+	}
+	merged.erase(std::remove_if(merged.begin(), merged.end(), [](const GlyphKerning& pair) {
+		return pair.advance == 0;
+	}), merged.end());
+	return merged;
+}
+
+//---
+
+void KerningTable::Assign(const std::vector<KerningPair>& pairs)
+{
+	Assign(pairs.data(), pairs.size());
+}
+
+void KerningTable::Assign(const KerningPair* pairs, size_t pairCount_)
+{
+	slots.clear();
+	mask = 0;
+	shift = 64;
+	pairCount = 0;
+	if (pairCount_ == 0) return;
+
+	// at most a quarter full
+	size_t capacity = 16;
+	shift = 60;
+	while (capacity < 4 * pairCount_) {
+		capacity *= 2;
+		shift--;
+	}
+	slots.assign(capacity, 0);
+	mask = capacity - 1;
+
+	for (size_t i = 0; i < pairCount_; i++) {
+		const KerningPair& pair = pairs[i];
+		if (pair.advance == 0 || pair.left >= kCodepointLimit || pair.right >= kCodepointLimit) continue;
+
+		uint64_t key = MakeKey(pair.left, pair.right);
+		uint64_t advance = uint16_t(std::clamp(pair.advance, int32_t(INT16_MIN), int32_t(INT16_MAX)));
+		size_t slot = Hash(key);
+		while (slots[slot] != 0 && (slots[slot] & kKeyMask) != key) {
+			slot = (slot + 1) & mask;
+		}
+		if (slots[slot] == 0) pairCount++;
+		slots[slot] = key | advance;
+	}
+}
+
+std::vector<KerningPair> KerningTable::GetPairs() const
+{
+	std::vector<KerningPair> pairs;
+	pairs.reserve(pairCount);
+	for (uint64_t slot : slots) {
+		if (slot == 0) continue;
+		uint64_t codepoints = (slot >> 16) - 1;
+		pairs.push_back(KerningPair {
+			.left = uint32_t(codepoints >> 21),
+			.right = uint32_t(codepoints & 0x1fffff),
+			.advance = int16_t(slot & kAdvanceMask)
+		});
+	}
+	std::sort(pairs.begin(), pairs.end(), [](const KerningPair& a, const KerningPair& b) {
+		return a.left < b.left || (a.left == b.left && a.right < b.right);
+	});
+	return pairs;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "stb_truetype.h"
+
+/// Kerning between two codepoints, as stored in the atlas cache and in baked atlases.
+struct KerningPair {
+	uint32_t left;
+	uint32_t right;
+	int32_t advance;	///< Added to the advance of the left glyph, in 1/64 pixels.
+};
+
+/// Kerning between two glyphs of a font, in font units.
+struct GlyphKerning {
+	int first;		///< Index of the left glyph in the list given to ReadKerning().
+	int second;		///< Index of the right glyph.
+	int advance;
+};
+
+/**
+ * Reads the kerning of all pairs among the given glyphs in one pass over the 'kern'
+ * table and the GPOS pair adjustments, with the same result as calling
+ * stbtt_GetGlyphKernAdvance() for every pair (and the same limitations: only
+ * horizontal format 0 'kern' tables and x-advance-only GPOS pair values).
+ * Only pairs with at least one glyph at firstNew or later in the list are read,
+ * so that glyphs added to a font cost in proportion to them, not to all glyphs.
+ * \return The pairs with non-zero kerning, ordered by first and second.
+ */
+std::vector<GlyphKerning> ReadKerning(const stbtt_fontinfo& font, const std::vector<int>& glyphs, size_t firstNew = 0);
+
+/**
+ * Kerning of codepoint pairs in an open-addressing hash table.
+ *
+ * Each slot is a single 64-bit word holding both codepoints (21 bits each)
+ * and the adjustment (16 bits, 1/64 pixels), and the table is kept at most
+ * a quarter full, so that the common case in layout, a pair that does not
+ * kern, is usually answered by the first slot probed.
+ */
+class KerningTable
+{
+public:
+
+	/// Replaces the contents with the pairs; pairs with zero advance are left out.
+	void Assign(const std::vector<KerningPair>& pairs);
+	void Assign(const KerningPair* pairs, size_t pairCount);
+
+	/// Returns the adjustment for the pair in 1/64 pixels, 0 if the pair does not kern.
+	int32_t Get(uint32_t left, uint32_t right) const
+	{
+		if (slots.empty() || left >= kCodepointLimit || right >= kCodepointLimit) return 0;
+		uint64_t key = MakeKey(left, right);
+		for (size_t i = Hash(key); ; i = (i + 1) & mask) {
+			uint64_t slot = slots[i];
+			if ((slot & kKeyMask) == key) return int16_t(slot & kAdvanceMask);
+			if (slot == 0) return 0;
+		}
+	}
+
+	size_t GetPairCount() const { return pairCount; }
+
+	/// Returns all pairs, ordered by left and right codepoint.
+	std::vector<KerningPair> GetPairs() const;
+
+private:
+
+	static const uint32_t kCodepointLimit = 0x110000;
+	static const uint64_t kAdvanceMask = 0xffff;
+	static const uint64_t kKeyMask = ~kAdvanceMask;
+
+	/// Both codepoints in the upper 42 bits; never 0, so that 0 can mark an empty slot.
+	static uint64_t MakeKey(uint32_t left, uint32_t right)
+	{
+		return ((uint64_t(left) << 21 | right) + 1) << 16;
+	}
+
+	size_t Hash(uint64_t key) const
+	{
+		// Fibonacci hashing: the top bits of the product are well mixed
+		return size_t((key * 0x9e3779b97f4a7c15ull) >> shift);
+	}
+
+	std::vector<uint64_t> slots;
+	size_t mask = 0;
+	int shift = 64;
+	size_t pairCount = 0;
+};
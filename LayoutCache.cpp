@@ -0,0 +1,85 @@
+#include "LayoutCache.h"
+#include "Hash.h"
+
+LayoutCache::LayoutCache(size_t byteBudget_)
+	: byteBudget(byteBudget_)
+{
+}
+
+uint64_t LayoutCache::Hash(const Font& font, int atlasVersion, int sizeIndex, float scale, std::string_view text)
+{
+	const Font* fontAddress = &font;
+	uint64_t hash = HashBytes(&fontAddress, sizeof(fontAddress));
+	hash = HashBytes(&atlasVersion, sizeof(atlasVersion), hash);
+	hash = HashBytes(&sizeIndex, sizeof(sizeIndex), hash);
+	hash = HashBytes(&scale, sizeof(scale), hash);
+	return HashBytes(text.data(), text.size(), hash);
+}
+
+const GlyphRun& LayoutCache::Get(const Font& font, const Utf8Text& text, float scale, int sizeIndex)
+{
+	int atlasVersion = font.GetAtlasVersion();
+	std::string_view bytes(text.GetData(), text.GetLength());
+	uint64_t hash = Hash(font, atlasVersion, sizeIndex, scale, bytes);
+
+	auto found = index.equal_range(hash);
+	for (auto it = found.first; it != found.second; ++it) {
+		Entry& entry = *it->second;
+		if (entry.font == &font && entry.atlasVersion == atlasVersion && entry.sizeIndex == sizeIndex && entry.scale == scale && entry.text == bytes) {
+			stats.hits++;
+			entries.splice(entries.begin(), entries, it->second);
+			return entry.run;
+		}
+	}
+
+	stats.misses++;
+	entries.push_front(Entry {
+		.font = &font,
+		.atlasVersion = atlasVersion,
+		.sizeIndex = sizeIndex,
+		.scale = scale,
+		.text = std::string(bytes),
+		.hash = hash,
+		.byteCount = 0,
+		.run = LayoutText(font, text, scale, sizeIndex)
+	});
+	Entry& entry = entries.front();
+
+	// the list node and the index node come on top of the entry itself
+	entry.byteCount = sizeof(Entry) + 4 * sizeof(void*) + sizeof(uint64_t)
+		+ entry.text.capacity()
+		+ entry.run.glyphs.capacity() * sizeof(PositionedGlyph);
+	index.emplace(hash, entries.begin());
+	stats.entryCount++;
+	stats.byteCount += entry.byteCount;
+
+	// the new entry itself is never evicted, even if it alone exceeds the budget
+	Evict();
+	return entry.run;
+}
+
+void LayoutCache::Evict()
+{
+	while (stats.byteCount > byteBudget && entries.size() > 1) {
+		const Entry& victim = entries.back();
+		auto found = index.equal_range(victim.hash);
+		for (auto it = found.first; it != found.second; ++it) {
+			if (&*it->second == &victim) {
+				index.erase(it);
+				break;
+			}
+		}
+		stats.byteCount -= victim.byteCount;
+		stats.entryCount--;
+		stats.evictions++;
+		entries.pop_back();
+	}
+}
+
+void LayoutCache::Clear()
+{
+	index.clear();
+	entries.clear();
+	stats.entryCount = 0;
+	stats.byteCount = 0;
+}
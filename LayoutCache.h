@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "TextLayout.h"
+
+/**
+ * Keeps the layouts of recently used strings, so that text that is shown
+ * again and again (status messages, host names, the repeated lines of a log)
+ * is laid out only once. TextBlock looks its paragraphs up here when given a cache.
+ *
+ * Entries are keyed by the font (and the version of its atlas, as a lazy font
+ * moves glyphs around when it grows), the size, the scale and the UTF-8 text; the least
+ * recently used ones are dropped when the entries take more than the byte budget.
+ * Fonts are identified by address, so Clear() the cache when a font is destroyed.
+ */
+class LayoutCache
+{
+public:
+
+	static const size_t kDefaultByteBudget = 1024 * 1024;
+
+	struct Stats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		size_t entryCount = 0;
+		size_t byteCount = 0;		///< Approximate memory used by the entries.
+	};
+
+	LayoutCache(size_t byteBudget_ = kDefaultByteBudget);
+
+	LayoutCache(const LayoutCache& src) = delete;
+
+	/**
+	 * Returns the layout of the text, calling LayoutText() only if it is not cached.
+	 * The reference is valid until the next call of Get() or Clear().
+	 */
+	const GlyphRun& Get(const Font& font, const Utf8Text& text, float scale = 1.0f, int sizeIndex = 0);
+
+	/// Drops all entries (the counters are kept).
+	void Clear();
+
+	Stats GetStats() const { return stats; }
+
+private:
+
+	struct Entry {
+		const Font* font;
+		int atlasVersion;
+		int sizeIndex;
+		float scale;
+		std::string text;			///< UTF-8.
+		uint64_t hash;
+		size_t byteCount;
+		GlyphRun run;
+	};
+
+	using EntryList = std::list<Entry>;
+
+	static uint64_t Hash(const Font& font, int atlasVersion, int sizeIndex, float scale, std::string_view text);
+
+	/// Drops least recently used entries until the budget is kept.
+	void Evict();
+
+	size_t byteBudget;
+	Stats stats;
+
+	/// Most recently used first.
+	EntryList entries;
+
+	/// Entries by hash (several entries may share one).
+	std::unordered_multimap<uint64_t, EntryList::iterator> index;
+};
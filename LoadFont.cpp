@@ -1,49 +1,398 @@
 #include "LoadFont.h"
 
+// the rect packer must be seen before the stb_truetype implementation,
+// otherwise stb_truetype falls back to its own trivial row packer
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "stb_rect_pack.h"
+
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "stb_truetype.h"
 
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cmath>
+
+namespace {
+
+/// Sets up the palette of an INDEX8 atlas surface so that index == gray level.
+void SetGrayscalePalette(SDL::Surface& surface)
+{
+	SDL_Color colorRamp[256];
+	for (int i = 0; i < 256; i++) {
+		colorRamp[i].r = i;
+		colorRamp[i].g = i;
+		colorRamp[i].b = i;
+		colorRamp[i].a = 255;
+	}
+	SDL_SetPaletteColors(surface.GetFormat()->palette, colorRamp, 0, 256);
+}
+
+/// A Unicode block that is encoded when its charset is requested.
+struct CharsetBlock {
+	uint32_t charset;
+	int first;
+	int count;
+};
+
+const CharsetBlock kCharsetBlocks[] = {
+
+	// 0x00..0x24f, this covers:
+	// - Basic Latin, aka ASCII (0x00..0x7f)
+	// - Latin 1 Supplement, aka ISO-8859-1 (0x80..0xff)
+	// - Latin Extended A (0x100..0x17f)
+	// - Latin Extended B (0x180..0x24f)
+	{ Font::kCharsetLatin, 0x0, 0x250 },
+
+	// Greek and Coptic (0x370..0x3ff)
+	{ Font::kCharsetGreek, 0x370, 0x90 },
+
+	// Cyrillic (0x400..0x4ff)
+	{ Font::kCharsetCyrillic, 0x400, 0x100 }
+};
+
+/// Number of glyphs rendered by one work item when rasterizing in parallel.
+const int kGlyphsPerChunk = 32;
+
+/// Largest atlas side we try (stb_rect_pack and stbtt_packedchar use 16-bit coordinates).
+const int kMaxAtlasSide = 16384;
+
+/**
+ * Calls work() on threadCount threads, this one included, and waits for all of them
+ * (0 means one per CPU core; never more threads than there are work items).
+ */
+template<class Work>
+void RunOnThreads(int threadCount, size_t workItemCount, Work work)
+{
+	if (threadCount <= 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threadCount = std::min(threadCount, int(workItemCount));
+
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threadCount; i++) {
+		workers.emplace_back(work);
+	}
+	work();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
 
-Font::Font(const MappedFile &fontFile, float fontSize, uint32_t extraCharsetSupport)
+/// Returns the smallest power of two that is >= value.
+int NextPowerOfTwo(int value)
+{
+	int result = 1;
+	while (result < value) {
+		result *= 2;
+	}
+	return result;
+}
+
+} // namespace
+
+Font::Font(const std::vector<FontCollection::FaceRef> &fontFaces, const std::vector<float> &fontSizes_,
+	uint32_t extraCharsetSupport, const AtlasCache* atlasCache, int threadCount, AtlasMode atlasMode_, int subpixelPhases_)
+	: atlasMode(atlasMode_)
 {
 	encodedCharsets = kCharsetLatin | extraCharsetSupport;
 
-	// count the total number of characters we will need to encode,
-	// to determine how large the pixel memory will need to be
-	encodedCharCount = 767;	// the basic set
-	if (extraCharsetSupport & kCharsetCyrillic)
-		encodedCharCount += 256;
-	if (extraCharsetSupport & kCharsetGreek)
-		encodedCharCount += 143;
+	if (!InitFontSizes(fontSizes_)) return;
+	if (!InitSubpixelPhases(subpixelPhases_)) return;
+	if (!InitFaces(fontFaces)) return;
+
+	std::vector<int> codepoints;
+	for (const CharsetBlock& block : kCharsetBlocks) {
+		if (!(encodedCharsets & block.charset)) continue;
+		for (int i = 0; i < block.count; i++) {
+			codepoints.push_back(block.first + i);
+		}
+	}
+	encodedCharCount = codepoints.size();
+
+	// every font and size gets a contiguous run of glyph slots that stb packs into directly
+	// (slot 0 is reserved to mean "not encoded")
+	glyphs.resize(1 + fontSizes.size() * encodedCharCount);
+	std::vector<FaceRange> ranges = MakeFaceRanges(codepoints, &glyphs[1]);
+	for (size_t size = 0; size < fontSizes.size(); size++) {
+		for (size_t i = 0; i < codepoints.size(); i++) {
+			glyphIndices[size].Set(codepoints[i], 1 + size * codepoints.size() + i);
+		}
+	}
+
+	// a cached atlas makes all of the packing below unnecessary
+	AtlasCache::Key cacheKey;
+	if (atlasCache) {
+		cacheKey = AtlasCache::MakeKey(fontFaces, fontSizes, encodedCharsets, uint32_t(atlasMode), uint32_t(subpixelPhases));
+		if (LoadFromCache(*atlasCache, cacheKey)) {
+			ok = true;
+			return;
+		}
+	}
+
+	if (!BuildAtlas(ranges, threadCount)) {
+		return;
+	}
+	std::vector<int> encoded;
+	glyphIndices[0].ForEach([&encoded](uint32_t codepoint, uint32_t slot) {
+		encoded.push_back(int(codepoint));
+	});
+	std::sort(encoded.begin(), encoded.end());
+	AddKerning(encoded);
+
+	// failing to store the atlas only costs the next run some time, so it is not an error
+	if (atlasCache) {
+		StoreToCache(*atlasCache, cacheKey);
+	}
+
+	ok = true;
+}
+
+Font::Font(const std::vector<FontCollection::FaceRef> &fontFaces, const std::vector<float> &fontSizes_,
+	const std::wstring &initialText, AtlasMode atlasMode_, int subpixelPhases_)
+	: atlasMode(atlasMode_), lazy(true)
+{
+	if (!InitFontSizes(fontSizes_)) return;
+	if (!InitSubpixelPhases(subpixelPhases_)) return;
+	if (!InitFaces(fontFaces)) return;
+
+	// start with an atlas just large enough for the text in all sizes; it grows on demand
+	uint64_t cellArea = 0;
+	for (float fontSize : fontSizes) {
+		cellArea += uint64_t(fontSize + 2) * uint64_t(fontSize + 2);
+	}
+	int side = 128;
+	while (side < 4096 && uint64_t(side) * side < cellArea * initialText.size()) {
+		side *= 2;
+	}
+	if (!CreateLazyAtlas(side)) return;
+
+	ok = true;
+	if (!AddGlyphs(initialText)) {
+		ok = false;
+	}
+}
+
+Font::Font(const BakedAtlas& bakedAtlas)
+	: fontSizes { bakedAtlas.fontSize }, baked(true), glyphIndices(1)
+{
+	encodedCharsets = bakedAtlas.charsets;
 
-	// FIXME: This is a wild guess!
-	int surfaceHeight = int(2*fontSize);
-	int surfaceWidth = encodedCharCount * int(fontSize);
+	glyphs.reserve(1 + bakedAtlas.glyphCount);
+	glyphs.push_back(stbtt_packedchar { 0 });
+	for (uint32_t i = 0; i < bakedAtlas.glyphCount; i++) {
+		glyphs.push_back(bakedAtlas.glyphs[i]);
+		glyphIndices[0].Set(bakedAtlas.codepoints[i], glyphs.size() - 1);
+	}
+	encodedCharCount = bakedAtlas.glyphCount;
+	kerning.Assign(bakedAtlas.kerningPairs, bakedAtlas.kerningPairCount);
 
+	// the surface uses the static pixels directly; SDL does not write to them
 	fontSurface = std::make_unique<SDL::Surface>(
-		surfaceWidth, surfaceHeight, 8, SDL_PIXELFORMAT_INDEX8
+		const_cast<uint8_t*>(bakedAtlas.pixels),
+		bakedAtlas.width, bakedAtlas.height, 8, bakedAtlas.pitch, SDL_PIXELFORMAT_INDEX8
 	);
 	if (!fontSurface->Ok()) {
 		SDL_SetError("Could not create surface: %s", SDL_GetError());
 		return;
 	}
+	SetGrayscalePalette(*fontSurface);
+	ok = true;
+}
 
-	SDL_Color colorRamp[256];
-	for (int i = 0; i < 256; i++) {
-		colorRamp[i].r = i;
-		colorRamp[i].g = i;
-		colorRamp[i].b = i;
-		colorRamp[i].a = 255;
+Font::~Font()
+{
+	if (packContextOpen) {
+		stbtt_PackEnd(&packContext);
+	}
+	ok = false;
+}
+
+bool Font::AddGlyphs(const std::wstring &text)
+{
+	if (!lazy) {
+		SDL_SetError("glyphs can only be added to a lazy font");
+		return false;
 	}
-	SDL_SetPaletteColors(fontSurface->GetFormat()->palette, colorRamp, 0, 256);
 
-	if (!stbtt_InitFont(&fontInfo, fontFile.GetData(), 0)) { /*stbtt_GetFontOffsetForIndex(fontFile.GetData(), 0) */
-		SDL_SetError("stbtt_InitFont() failed");
-		return;
+	// collect the distinct codepoints that are not encoded yet (all sizes have the same ones);
+	// controls would only be packed as .notdef boxes
+	std::vector<int> missing;
+	for (wchar_t c : text) {
+		if (!IsControlCharacter(uint32_t(c)) && !glyphIndices[0].Get(uint32_t(c))) {
+			missing.push_back(int(c));
+		}
+	}
+	if (missing.empty()) return true;
+	std::sort(missing.begin(), missing.end());
+	missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+	if (PackLazyGlyphs(missing)) {
+		AddKerning(missing);
+		atlasVersion++;
+		return true;
 	}
 
-	stbtt_pack_context packContext = { 0 };
+	// out of space: repack everything into a larger atlas (the kerning of the glyphs there stays)
+	std::vector<int> added = missing;
+	glyphIndices[0].ForEach([&missing](uint32_t codepoint, uint32_t slot) {
+		missing.push_back(int(codepoint));
+	});
+	for (int side = fontSurface->GetWidth() * 2; side <= 8192; side *= 2) {
+		if (!CreateLazyAtlas(side)) return false;
+		if (PackLazyGlyphs(missing)) {
+			AddKerning(added);
+			atlasVersion++;
+			return true;
+		}
+	}
+	SDL_SetError("glyphs do not fit into the largest atlas");
+	return false;
+}
+
+void Font::AddKerning(const std::vector<int> &addedCodepoints)
+{
+	// kerning applies only between glyphs of the same font; it is kept for one size only,
+	// as it scales linearly to the others; per face, the glyphs that were there come first
+	std::vector<std::vector<uint32_t>> faceCodepoints(faces.size());
+	glyphIndices[0].ForEach([this, &faceCodepoints, &addedCodepoints](uint32_t codepoint, uint32_t slot) {
+		if (!std::binary_search(addedCodepoints.begin(), addedCodepoints.end(), int(codepoint))) {
+			faceCodepoints[SelectFace(codepoint)].push_back(codepoint);
+		}
+	});
+	std::vector<size_t> firstAdded(faces.size());
+	for (size_t face = 0; face < faces.size(); face++) {
+		firstAdded[face] = faceCodepoints[face].size();
+	}
+	for (int codepoint : addedCodepoints) {
+		if (glyphIndices[0].Get(uint32_t(codepoint))) {
+			faceCodepoints[SelectFace(uint32_t(codepoint))].push_back(uint32_t(codepoint));
+		}
+	}
+
+	std::vector<KerningPair> pairs = kerning.GetPairs();
+	for (size_t face = 0; face < faces.size(); face++) {
+		const stbtt_fontinfo& info = faces[face]->info;
+		const std::vector<uint32_t>& codepoints = faceCodepoints[face];
+		if (firstAdded[face] == codepoints.size()) continue;
+		std::vector<int> glyphIds;
+		for (uint32_t codepoint : codepoints) {
+			glyphIds.push_back(stbtt_FindGlyphIndex(&info, codepoint));
+		}
+
+		float scale = stbtt_ScaleForPixelHeight(&info, GetKerningFontSize());
+		for (const GlyphKerning& glyphKerning : ReadKerning(info, glyphIds, firstAdded[face])) {
+			pairs.push_back(KerningPair {
+				.left = codepoints[glyphKerning.first],
+				.right = codepoints[glyphKerning.second],
+				.advance = int32_t(std::lround(glyphKerning.advance * scale * 64.0f))
+			});
+		}
+	}
+	kerning.Assign(pairs);
+}
+
+bool Font::InitFontSizes(const std::vector<float> &fontSizes_)
+{
+	if (fontSizes_.empty()) {
+		SDL_SetError("no font size given");
+		return false;
+	}
+	for (float fontSize : fontSizes_) {
+		if (!(fontSize > 0.0f)) {
+			SDL_SetError("invalid font size %g", fontSize);
+			return false;
+		}
+	}
+	fontSizes = fontSizes_;
+	glyphIndices.resize(fontSizes.size());
+	return true;
+}
+
+bool Font::InitSubpixelPhases(int subpixelPhases_)
+{
+	if (subpixelPhases_ < 1 || subpixelPhases_ > kMaxSubpixelPhases) {
+		SDL_SetError("subpixel phases must be 1 to %d", kMaxSubpixelPhases);
+		return false;
+	}
+
+	// distance fields are sampled at any position anyway
+	subpixelPhases = (atlasMode == AtlasMode::kSdf) ? 1 : subpixelPhases_;
+	return true;
+}
+
+bool Font::InitFaces(const std::vector<FontCollection::FaceRef> &fontFaces)
+{
+	if (fontFaces.empty()) {
+		SDL_SetError("no font given");
+		return false;
+	}
+	for (const FontCollection::FaceRef& fontFace : fontFaces) {
+		const FontCollection::Face* face = fontFace.collection->GetFace(fontFace.index);
+		if (!face) return false;
+		faces.push_back(face);
+	}
+	return true;
+}
+
+std::vector<Font::FaceRange> Font::MakeFaceRanges(std::vector<int> &codepoints, stbtt_packedchar* packedChars) const
+{
+	// a single font needs no grouping, which also keeps the order of the codepoints
+	if (faces.size() > 1) {
+		std::stable_sort(codepoints.begin(), codepoints.end(), [this](int a, int b) {
+			return SelectFace(a) < SelectFace(b);
+		});
+	}
+
+	// the ranges of all sizes share the codepoints
+	std::vector<FaceRange> ranges;
+	for (size_t size = 0; size < fontSizes.size(); size++) {
+		stbtt_packedchar* sizeChars = packedChars + size * codepoints.size();
+		for (size_t first = 0; first < codepoints.size(); ) {
+			int face = SelectFace(codepoints[first]);
+			size_t end = first + 1;
+			while (end < codepoints.size() && SelectFace(codepoints[end]) == face) {
+				end++;
+			}
+			ranges.push_back(FaceRange {
+				.face = face,
+				.range = stbtt_pack_range {
+					.font_size = fontSizes[size],
+					.first_unicode_codepoint_in_range = 0,
+					.array_of_unicode_codepoints = &codepoints[first],
+					.num_chars = int(end - first),
+					.chardata_for_range = sizeChars + first,
+					.h_oversample = 0,
+					.v_oversample = 0
+				}
+			});
+			first = end;
+		}
+	}
+	return ranges;
+}
+
+bool Font::CreateLazyAtlas(int side)
+{
+	if (packContextOpen) {
+		stbtt_PackEnd(&packContext);
+		packContextOpen = false;
+	}
+	glyphs.assign(1, stbtt_packedchar { 0 });
+	for (CodepointTable& glyphIndex : glyphIndices) {
+		glyphIndex.Clear();
+	}
+	encodedCharCount = 0;
+
+	fontSurface = std::make_unique<SDL::Surface>(side, side, 8, SDL_PIXELFORMAT_INDEX8);
+	if (!fontSurface->Ok()) {
+		SDL_SetError("Could not create surface: %s", SDL_GetError());
+		return false;
+	}
+	SetGrayscalePalette(*fontSurface);
+
 	if (!stbtt_PackBegin(
 		&packContext,
 		static_cast<uint8_t*>(fontSurface->GetPixels()),
@@ -51,85 +400,366 @@ Font::Font(const MappedFile &fontFile, float fontSize, uint32_t extraCharsetSupp
 		1, nullptr)
 	) {
 		SDL_SetError("stbtt_PackBegin() failed");
-		return;
+		return false;
 	}
+	stbtt_PackSetOversampling(&packContext, subpixelPhases, 1);
+	packContextOpen = true;
+	return true;
+}
 
-	// map character range: 0x00..0x24f, this covers:
-	// - Basic Latin, aka ASCII (0x00..0x7f)
-	// - Latin 1 Supplement, aka ISO-8859-1 (0x80..0xff)
-	// - Latin Extended A (0x100..0x17f)
-	// - Latin Extended B (0x180..0x24f)
-	packedCharRanges.push_back(stbtt_pack_range {
-		.font_size = fontSize,
-		.first_unicode_codepoint_in_range = 0x0,
-		.array_of_unicode_codepoints = nullptr,
-		.num_chars = 0x24f,
-		.chardata_for_range = packedCharsBasic.data(),
-		.h_oversample = 0,
-		.v_oversample = 0
-	});
+bool Font::PackLazyGlyphs(std::vector<int> &codepoints)
+{
+	std::vector<stbtt_packedchar> packedChars(fontSizes.size() * codepoints.size());
+	std::vector<FaceRange> ranges = MakeFaceRanges(codepoints, packedChars.data());
 
-	// if requested, add Greek and Coptic (0x370..0x3ff)
-	if (extraCharsetSupport & kCharsetGreek) {
-		packedCharRanges.push_back(stbtt_pack_range {
-			.font_size = fontSize,
-			.first_unicode_codepoint_in_range = 0x370,
-			.array_of_unicode_codepoints = nullptr,
-			.num_chars = 0x3ff - 0x370,
-			.chardata_for_range = packedCharsGreek.data(),
-			.h_oversample = 0,
-			.v_oversample = 0
-		});
+	// the pack context remembers the occupied space, so this only adds to the atlas
+	if (!PackAndRender(packContext, ranges, 1)) {
+		return false;
+	}
+	for (size_t size = 0; size < fontSizes.size(); size++) {
+		for (size_t i = 0; i < codepoints.size(); i++) {
+			glyphs.push_back(packedChars[size * codepoints.size() + i]);
+			glyphIndices[size].Set(codepoints[i], glyphs.size() - 1);
+		}
 	}
+	encodedCharCount += codepoints.size();
+	return true;
+}
 
-	// if requested, add Cyrillic (0x400..0x4ff)
-	if (extraCharsetSupport & kCharsetCyrillic) {
-		packedCharRanges.push_back(stbtt_pack_range {
-			.font_size = fontSize,
-			.first_unicode_codepoint_in_range = 0x400,
-			.array_of_unicode_codepoints = nullptr,
-			.num_chars = 0x4ff - 0x400,
-			.chardata_for_range = packedCharsCyrillic.data(),
-			.h_oversample = 0,
-			.v_oversample = 0		
-		});
+int Font::GatherRects(stbtt_pack_context &context, std::vector<FaceRange> &ranges, std::vector<stbrp_rect> &rects,
+	std::vector<SdfBitmap> &sdfs, int threadCount)
+{
+	// a distance field is only as large as the outline plus the padding, which only rendering tells
+	if (atlasMode == AtlasMode::kSdf) {
+		sdfs = RenderSdfs(ranges, threadCount);
+		rects.assign(sdfs.size(), stbrp_rect { 0 });
+		for (size_t i = 0; i < sdfs.size(); i++) {
+			rects[i].id = int(i);
+			if (sdfs[i].width > 0 && sdfs[i].height > 0) {
+				rects[i].w = stbrp_coord(sdfs[i].width + context.padding);
+				rects[i].h = stbrp_coord(sdfs[i].height + context.padding);
+			}
+		}
+		return int(sdfs.size());
 	}
 
-	if (!stbtt_PackFontRanges(&packContext, fontFile.GetData(), 0, packedCharRanges.data(), packedCharRanges.size())) {
-		SDL_SetError("stbtt_PackFontRanges() failed");
-		stbtt_PackEnd(&packContext);
-		return;
+	int glyphCount = 0;
+	for (const FaceRange& faceRange : ranges) {
+		glyphCount += faceRange.range.num_chars;
 	}
+	rects.resize(glyphCount);
 
-	ok = true;
+	// the rects of all fonts end up in one array, so that they are packed together
+	int rectCount = 0;
+	for (FaceRange& faceRange : ranges) {
+		rectCount += stbtt_PackFontRangesGatherRects(&context, &faces[faceRange.face]->info,
+			&faceRange.range, 1, &rects[rectCount]);
+	}
+	return rectCount;
 }
 
-Font::~Font()
+std::vector<Font::SdfBitmap> Font::RenderSdfs(std::vector<FaceRange> &ranges, int threadCount)
 {
-	ok = false;
+	struct Job {
+		const stbtt_fontinfo* font;
+		float fontSize;
+		int codepoint;
+	};
+	std::vector<Job> jobs;
+	for (const FaceRange& faceRange : ranges) {
+		const stbtt_pack_range& range = faceRange.range;
+		for (int i = 0; i < range.num_chars; i++) {
+			int codepoint = range.array_of_unicode_codepoints
+				? range.array_of_unicode_codepoints[i]
+				: range.first_unicode_codepoint_in_range + i;
+			jobs.push_back(Job { &faces[faceRange.face]->info, range.font_size, codepoint });
+		}
+	}
+
+	// every glyph goes into its own bitmap, so chunks of them can be rendered by any thread
+	std::vector<SdfBitmap> sdfs(jobs.size());
+	std::atomic<size_t> nextJob(0);
+	auto renderSdfs = [&jobs, &sdfs, &nextJob]() {
+		for (size_t first = nextJob.fetch_add(kGlyphsPerChunk); first < jobs.size(); first = nextJob.fetch_add(kGlyphsPerChunk)) {
+			size_t end = std::min(first + kGlyphsPerChunk, jobs.size());
+			for (size_t i = first; i < end; i++) {
+				const stbtt_fontinfo* font = jobs[i].font;
+				float scale = stbtt_ScaleForPixelHeight(font, jobs[i].fontSize);
+				int glyph = stbtt_FindGlyphIndex(font, jobs[i].codepoint);
+
+				SdfBitmap& sdf = sdfs[i];
+				int advance, leftSideBearing;
+				stbtt_GetGlyphHMetrics(font, glyph, &advance, &leftSideBearing);
+				sdf.xadvance = scale * advance;
+
+				// glyphs without an outline (spaces) have no bitmap
+				unsigned char* pixels = stbtt_GetGlyphSDF(font, scale, glyph, kSdfPadding, kSdfOnEdge, kSdfPixelDistScale,
+					&sdf.width, &sdf.height, &sdf.xoff, &sdf.yoff);
+				if (pixels) {
+					sdf.pixels.assign(pixels, pixels + sdf.width * sdf.height);
+					stbtt_FreeSDF(pixels, nullptr);
+				}
+				else {
+					sdf.width = sdf.height = 0;
+				}
+			}
+		}
+	};
+	RunOnThreads(threadCount, (jobs.size() + kGlyphsPerChunk - 1) / kGlyphsPerChunk, renderSdfs);
+	return sdfs;
 }
 
-const stbtt_packedchar* Font::GetPackedChar(int charCode) const
+bool Font::CopySdfs(stbtt_pack_context &context, std::vector<FaceRange> &ranges,
+	std::vector<stbrp_rect> &rects, std::vector<SdfBitmap> &sdfs)
 {
-	if (charCode < 0x24f) {
+	size_t i = 0;
+	for (const FaceRange& faceRange : ranges) {
+		for (int j = 0; j < faceRange.range.num_chars; j++, i++) {
+			const SdfBitmap& sdf = sdfs[i];
+			const stbrp_rect& rect = rects[i];
+			stbtt_packedchar& glyph = faceRange.range.chardata_for_range[j];
+			glyph = stbtt_packedchar { 0 };
+			glyph.xadvance = sdf.xadvance;
+			if (sdf.width == 0 || sdf.height == 0) continue;
 
-		// this block of characters is always encoded
-		return &(packedCharsBasic[charCode]);
+			if (!rect.was_packed) {
+				SDL_SetError("glyphs do not fit into the atlas");
+				return false;
+			}
+			for (int y = 0; y < sdf.height; y++) {
+				memcpy(context.pixels + (rect.y + y) * context.stride_in_bytes + rect.x,
+					&sdf.pixels[y * sdf.width], sdf.width);
+			}
+			glyph.x0 = rect.x;
+			glyph.y0 = rect.y;
+			glyph.x1 = rect.x + sdf.width;
+			glyph.y1 = rect.y + sdf.height;
+			glyph.xoff = sdf.xoff;
+			glyph.yoff = sdf.yoff;
+			glyph.xoff2 = sdf.xoff + sdf.width;
+			glyph.yoff2 = sdf.yoff + sdf.height;
+		}
 	}
-	else if ((encodedCharsets & kCharsetCyrillic) && (charCode >= 0x400 && charCode <= 0x4ff)) {
-		return &(packedCharsCyrillic[charCode - 0x400]);
+	return true;
+}
+
+bool Font::PackAndRender(stbtt_pack_context &context, std::vector<FaceRange> &ranges, int threadCount)
+{
+	// placing the glyphs depends on all of them, so it is done up front on this thread
+	std::vector<stbrp_rect> rects;
+	std::vector<SdfBitmap> sdfs;
+	int rectCount = GatherRects(context, ranges, rects, sdfs, threadCount);
+	stbtt_PackFontRangesPackRects(&context, rects.data(), rectCount);
+
+	if (atlasMode == AtlasMode::kSdf) {
+		return CopySdfs(context, ranges, rects, sdfs);
 	}
-	else if ((encodedCharsets & kCharsetGreek) && (charCode >= 0x370 && charCode <= 0x3ff)) {
-		return &(packedCharsGreek[charCode - 0x370]);
+	return RenderRects(context, ranges, rects, threadCount);
+}
+
+bool Font::BuildAtlas(std::vector<FaceRange> &ranges, int threadCount)
+{
+	// measure the boxes of all glyphs first (a context without pixels is enough for that)
+	stbtt_pack_context context = { 0 };
+	if (!stbtt_PackBegin(&context, nullptr, kMaxAtlasSide, kMaxAtlasSide, 0, 1, nullptr)) {
+		SDL_SetError("stbtt_PackBegin() failed");
+		return false;
 	}
 
-	// not encoded
-	return nullptr;	
+	// the oversampling is remembered by the ranges, which is what renders them later
+	stbtt_PackSetOversampling(&context, subpixelPhases, 1);
+	std::vector<stbrp_rect> rects;
+	std::vector<SdfBitmap> sdfs;
+	int rectCount = GatherRects(context, ranges, rects, sdfs, threadCount);
+	stbtt_PackEnd(&context);
+
+	uint64_t totalArea = 0;
+	int maxWidth = 1, maxHeight = 1;
+	for (int i = 0; i < rectCount; i++) {
+		totalArea += uint64_t(rects[i].w) * rects[i].h;
+		maxWidth = std::max(maxWidth, int(rects[i].w));
+		maxHeight = std::max(maxHeight, int(rects[i].h));
+	}
+
+	// start with the smallest near-square power-of-two atlas that could hold everything
+	// (packing is cheap compared to rendering, so an optimistic first guess costs little)
+	int width = NextPowerOfTwo(maxWidth);
+	int height = NextPowerOfTwo(maxHeight);
+	while (uint64_t(width) * height < totalArea) {
+		if (width <= height) width *= 2;
+		else height *= 2;
+	}
+
+	// grow alternately in both directions until all glyphs fit
+	packAttempts = 0;
+	while (true) {
+		if (width > kMaxAtlasSide || height > kMaxAtlasSide) {
+			SDL_SetError("glyphs do not fit into the largest atlas");
+			return false;
+		}
+		if (!stbtt_PackBegin(&context, nullptr, width, height, width, 1, nullptr)) {
+			SDL_SetError("stbtt_PackBegin() failed");
+			return false;
+		}
+		packAttempts++;
+		stbtt_PackFontRangesPackRects(&context, rects.data(), rectCount);
+		bool allPacked = std::all_of(rects.begin(), rects.begin() + rectCount, [](const stbrp_rect& rect) {
+			return rect.was_packed || rect.w == 0 || rect.h == 0;
+		});
+		if (allPacked) break;
+
+		stbtt_PackEnd(&context);
+		if (width <= height) width *= 2;
+		else height *= 2;
+	}
+
+	// only now that the size is known, allocate the pixels and render into them
+	fontSurface = std::make_unique<SDL::Surface>(width, height, 8, SDL_PIXELFORMAT_INDEX8);
+	if (!fontSurface->Ok()) {
+		SDL_SetError("Could not create surface: %s", SDL_GetError());
+		stbtt_PackEnd(&context);
+		return false;
+	}
+	SetGrayscalePalette(*fontSurface);
+	context.pixels = static_cast<uint8_t*>(fontSurface->GetPixels());
+	context.stride_in_bytes = fontSurface->GetPitch();
+
+	bool rendered = (atlasMode == AtlasMode::kSdf)
+		? CopySdfs(context, ranges, rects, sdfs)
+		: RenderRects(context, ranges, rects, threadCount);
+	stbtt_PackEnd(&context);
+	return rendered;
+}
+
+bool Font::RenderRects(stbtt_pack_context &context, std::vector<FaceRange> &ranges,
+	std::vector<stbrp_rect> &rects, int threadCount)
+{
+	// Rendering a glyph touches only its own rect, so the glyphs can be split
+	// into chunks and rendered in any order by any thread with the same result.
+	struct Chunk {
+		const stbtt_fontinfo* font;
+		stbtt_pack_range range;
+		stbrp_rect* rects;
+	};
+	std::vector<Chunk> chunks;
+	int firstRect = 0;
+	for (const FaceRange& faceRange : ranges) {
+		const stbtt_pack_range& range = faceRange.range;
+		for (int first = 0; first < range.num_chars; first += kGlyphsPerChunk) {
+			Chunk chunk = { &faces[faceRange.face]->info, range, &rects[firstRect + first] };
+			chunk.range.num_chars = std::min(kGlyphsPerChunk, range.num_chars - first);
+			chunk.range.chardata_for_range += first;
+			if (range.array_of_unicode_codepoints) {
+				chunk.range.array_of_unicode_codepoints += first;
+			}
+			else {
+				chunk.range.first_unicode_codepoint_in_range += first;
+			}
+			chunks.push_back(chunk);
+		}
+		firstRect += range.num_chars;
+	}
+
+	std::atomic<size_t> nextChunk(0);
+	std::atomic<bool> allRendered(true);
+	auto renderChunks = [&context, &chunks, &nextChunk, &allRendered]() {
+
+		// the renderer temporarily modifies the context, so each thread needs its own copy
+		stbtt_pack_context threadContext = context;
+		for (size_t i = nextChunk++; i < chunks.size(); i = nextChunk++) {
+			if (!stbtt_PackFontRangesRenderIntoRects(&threadContext, chunks[i].font, &chunks[i].range, 1, chunks[i].rects)) {
+				allRendered = false;
+			}
+		}
+	};
+
+	RunOnThreads(threadCount, chunks.size(), renderChunks);
+
+	if (!allRendered) {
+		SDL_SetError("glyphs do not fit into the atlas");
+		return false;
+	}
+	return true;
+}
+
+Font::AtlasStats Font::GetAtlasStats() const
+{
+	AtlasStats stats;
+	stats.width = fontSurface ? fontSurface->GetWidth() : 0;
+	stats.height = fontSurface ? fontSurface->GetHeight() : 0;
+	stats.glyphCount = encodedCharCount * int(fontSizes.size());
+	stats.packAttempts = packAttempts;
+	for (size_t slot = 1; slot < glyphs.size(); slot++) {
+		stats.glyphArea += uint64_t(glyphs[slot].x1 - glyphs[slot].x0) * (glyphs[slot].y1 - glyphs[slot].y0);
+	}
+	if (stats.width > 0 && stats.height > 0) {
+		stats.efficiency = double(stats.glyphArea) / (double(stats.width) * stats.height);
+	}
+	return stats;
 }
 
-bool Font::GetGlyphRect(int charCode, SDL_Rect& result) const
+const stbtt_packedchar* Font::GetPackedChar(int charCode, int sizeIndex) const
 {
-	const stbtt_packedchar* packedChar = GetPackedChar(charCode);
+	if (sizeIndex < 0 || sizeIndex >= int(glyphIndices.size())) return nullptr;
+	uint32_t slot = glyphIndices[sizeIndex].Get(uint32_t(charCode));
+	return slot ? &glyphs[slot] : nullptr;
+}
+
+stbtt_packedchar* Font::GetPackedChar(int charCode, int sizeIndex)
+{
+	return const_cast<stbtt_packedchar*>(static_cast<const Font*>(this)->GetPackedChar(charCode, sizeIndex));
+}
+
+bool Font::LoadFromCache(const AtlasCache& atlasCache, const AtlasCache::Key& cacheKey)
+{
+	std::unique_ptr<AtlasCache::Entry> entry = atlasCache.Load(cacheKey);
+	if (!entry) return false;
+
+	// every glyph we are going to encode must be present in the entry
+	if (entry->GetGlyphCount() != uint32_t(encodedCharCount) * fontSizes.size()) return false;
+	for (uint32_t i = 0; i < entry->GetGlyphCount(); i++) {
+		const AtlasCache::Glyph& glyph = entry->GetGlyphs()[i];
+		stbtt_packedchar* packedChar = GetPackedChar(glyph.codepoint, glyph.sizeIndex);
+		if (!packedChar) return false;
+		*packedChar = glyph.geometry;
+	}
+	kerning.Assign(entry->GetKerningPairs(), entry->GetKerningPairCount());
+
+	// the surface uses the mapped pixels directly, so the entry must stay alive with it
+	auto surface = std::make_unique<SDL::Surface>(
+		const_cast<uint8_t*>(entry->GetPixels()),
+		entry->GetWidth(), entry->GetHeight(), 8, entry->GetPitch(), SDL_PIXELFORMAT_INDEX8
+	);
+	if (!surface->Ok()) return false;
+	SetGrayscalePalette(*surface);
+
+	fontSurface = std::move(surface);
+	cachedAtlas = std::move(entry);
+	return true;
+}
+
+bool Font::StoreToCache(const AtlasCache& atlasCache, const AtlasCache::Key& cacheKey)
+{
+	std::vector<AtlasCache::Glyph> cachedGlyphs;
+	cachedGlyphs.reserve(encodedCharCount * fontSizes.size());
+	for (size_t size = 0; size < fontSizes.size(); size++) {
+		glyphIndices[size].ForEach([this, &cachedGlyphs, size](uint32_t codepoint, uint32_t slot) {
+			cachedGlyphs.push_back(AtlasCache::Glyph {
+				.codepoint = int32_t(codepoint),
+				.sizeIndex = int32_t(size),
+				.geometry = glyphs[slot]
+			});
+		});
+	}
+
+	return atlasCache.Store(cacheKey, cachedGlyphs, kerning.GetPairs(),
+		static_cast<const uint8_t*>(fontSurface->GetPixels()),
+		fontSurface->GetWidth(), fontSurface->GetHeight(), fontSurface->GetPitch());
+}
+
+bool Font::GetGlyphRect(int charCode, SDL_Rect& result, int sizeIndex) const
+{
+	const stbtt_packedchar* packedChar = GetPackedChar(charCode, sizeIndex);
 	if (!packedChar) return false;
 
 	result.x = packedChar->x0;
@@ -139,32 +769,52 @@ bool Font::GetGlyphRect(int charCode, SDL_Rect& result) const
 	return true;
 }
 
-bool Font::GetGlyphGeometry(int charCode, stbtt_packedchar &glyphGeometry) const
+bool Font::GetGlyphGeometry(int charCode, stbtt_packedchar &glyphGeometry, int sizeIndex) const
 {
-	const stbtt_packedchar* packedChar = GetPackedChar(charCode);
+	const stbtt_packedchar* packedChar = GetPackedChar(charCode, sizeIndex);
 	if (!packedChar) return false;
 
 	glyphGeometry = *packedChar;
 	return true;
 }
 
-SDL_Rect Font::ComputeTextSize(const std::wstring &text)
+template<class Text>
+SDL_Rect Font::MeasureText(const Text &text, int sizeIndex)
 {
-	int x = 0, maxY = 0;
-	for (wchar_t c : text) {
+	float x = 0.0f;
+	int maxY = 0;
+	uint32_t previous = 0;
+	for (uint32_t c : text) {
 		stbtt_packedchar glyphGeometry;
-		if (GetGlyphGeometry(int(c), glyphGeometry)) {
+		if (GetGlyphGeometry(int(c), glyphGeometry, sizeIndex)) {
+			if (previous) {
+				x += GetKerning(int(previous), int(c), sizeIndex);
+			}
 			x += glyphGeometry.xadvance;
 			if (glyphGeometry.y1 - glyphGeometry.y0 > maxY) {
 				maxY = glyphGeometry.y1 - glyphGeometry.y0;
 			}
+			previous = c;
+		}
+		else {
+			previous = 0;
 		}
 	}
 
 	SDL_Rect result;
 	result.x = 0;
 	result.y = 0;
-	result.w = x;
-	result.y = maxY;
+	result.w = int(x + 0.5f);
+	result.h = maxY;
 	return result;
-}
\ No newline at end of file
+}
+
+SDL_Rect Font::ComputeTextSize(const std::wstring &text, int sizeIndex)
+{
+	return MeasureText(text, sizeIndex);
+}
+
+SDL_Rect Font::ComputeTextSize(const Utf8Text &text, int sizeIndex)
+{
+	return MeasureText(text, sizeIndex);
+}
@@ -3,42 +3,312 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <algorithm>
 
 #include "SDLWrapper.h"
 #include "MapFile.h"
+#include "AtlasCache.h"
+#include "CodepointTable.h"
+#include "FontCoverage.h"
+#include "FontCollection.h"
+#include "BakedAtlas.h"
+#include "Kerning.h"
+#include "ToUnicode.h"
 
 #include "stb_truetype.h"
 
+/// True for characters that are never drawn, so fonts need no glyphs for them: the explicit
+/// line breaks that TextBlock splits paragraphs at (LF, CR, NEL, LS and PS) and the other controls.
+inline bool IsControlCharacter(uint32_t c)
+{
+	return c < 0x20 || c == 0x7f || c == 0x85 || c == 0x2028 || c == 0x2029;
+}
+
 class Font {
 public:
 
+	/// Describes how well the glyphs fill the atlas.
+	struct AtlasStats {
+		int width = 0;
+		int height = 0;
+		int glyphCount = 0;
+		uint64_t glyphArea = 0;		///< Pixels covered by glyph images (without padding).
+		double efficiency = 0.0;	///< glyphArea relative to the atlas area.
+		int packAttempts = 0;		///< Atlas sizes tried before all glyphs fit (0 if not packed here).
+	};
+
 	static const uint32_t kCharsetLatin = 0x1;
 	static const uint32_t kCharsetCyrillic = 0x2;
 	static const uint32_t kCharsetGreek = 0x4;
 
-	Font(const MappedFile &fontFile, float fontSize, uint32_t extraCharsetSupport = 0);
+	/// What the atlas pixels hold.
+	enum class AtlasMode : uint32_t {
+		kCoverage = 0,	///< Antialiased glyph coverage, to be drawn at the font size.
+		kSdf = 1		///< Signed distance fields, to be drawn at any size with DrawSdfGlyph().
+	};
+
+	/// Distance fields reach this many atlas pixels beyond the outline.
+	static const int kSdfPadding = 6;
+
+	/// Distance field value on the outline (inside is larger).
+	static const uint8_t kSdfOnEdge = 128;
+
+	/// Distance field units per atlas pixel of distance.
+	static constexpr float kSdfPixelDistScale = float(kSdfOnEdge) / kSdfPadding;
+
+	/// Most horizontal subpixel phases a coverage atlas can hold.
+	static const int kMaxSubpixelPhases = 4;
+
+	/**
+	 * Packs the glyphs of the requested charsets into an atlas.
+	 * The font files form a fallback chain: each glyph comes from the first font
+	 * that covers its codepoint (or from the first font if none does), and the
+	 * glyphs of all fonts share one atlas.
+	 * If a cache is given, the atlas is taken from it when a matching entry exists,
+	 * and stored into it after packing otherwise.
+	 * Glyphs are rendered by threadCount threads (0 means one per CPU core);
+	 * the resulting atlas does not depend on the number of threads.
+	 * In kSdf mode, fontSize only sets the resolution of the distance fields.
+	 *
+	 * With subpixelPhases > 1 (kCoverage mode only), glyphs are rasterized with
+	 * that much horizontal oversampling, so that the atlas holds each of them at
+	 * 1/subpixelPhases pixel offsets; draw them with DrawSubpixelGlyph().
+	 * This multiplies the atlas width and the rasterization work by about subpixelPhases.
+	 *
+	 * With several font sizes, the glyphs of every size are packed into the one atlas
+	 * (so one texture serves all of them); glyphs are then looked up by size index,
+	 * the position of the size in fontSizes.
+	 */
+	Font(const std::vector<FontCollection::FaceRef> &fontFaces, const std::vector<float> &fontSizes,
+		uint32_t extraCharsetSupport = 0, const AtlasCache* atlasCache = nullptr, int threadCount = 0,
+		AtlasMode atlasMode = AtlasMode::kCoverage, int subpixelPhases = 1);
+
+	Font(const std::vector<FontCollection::FaceRef> &fontFaces, float fontSize, uint32_t extraCharsetSupport = 0,
+		const AtlasCache* atlasCache = nullptr, int threadCount = 0, AtlasMode atlasMode = AtlasMode::kCoverage,
+		int subpixelPhases = 1)
+		: Font(fontFaces, std::vector<float> { fontSize }, extraCharsetSupport, atlasCache, threadCount, atlasMode,
+			subpixelPhases) {}
+
+	/// Uses the first face of the font file.
+	Font(const FontCollection &fontFile, float fontSize, uint32_t extraCharsetSupport = 0,
+		const AtlasCache* atlasCache = nullptr, int threadCount = 0)
+		: Font(std::vector<FontCollection::FaceRef> { &fontFile }, fontSize, extraCharsetSupport, atlasCache, threadCount) {}
+
+	/**
+	 * Lazy variant: packs only the glyphs of the characters that occur in the text,
+	 * whatever Unicode block they come from. More glyphs can be added later
+	 * with AddGlyphs() (in all sizes). The font collections must exist for the lifetime of the font.
+	 */
+	Font(const std::vector<FontCollection::FaceRef> &fontFaces, const std::vector<float> &fontSizes,
+		const std::wstring &initialText, AtlasMode atlasMode = AtlasMode::kCoverage, int subpixelPhases = 1);
+
+	Font(const std::vector<FontCollection::FaceRef> &fontFaces, float fontSize, const std::wstring &initialText,
+		AtlasMode atlasMode = AtlasMode::kCoverage, int subpixelPhases = 1)
+		: Font(fontFaces, std::vector<float> { fontSize }, initialText, atlasMode, subpixelPhases) {}
+
+	Font(const FontCollection &fontFile, float fontSize, const std::wstring &initialText)
+		: Font(std::vector<FontCollection::FaceRef> { &fontFile }, fontSize, initialText) {}
+
+	/**
+	 * Uses an atlas that was baked into the executable; there is no font file behind it,
+	 * so FindFace() finds nothing and no glyphs can be added.
+	 */
+	explicit Font(const BakedAtlas& bakedAtlas);
+
+	Font(const Font& src) = delete;
 	~Font();
 	bool Ok() const { return ok; }
-	bool GetGlyphRect(int charCode, SDL_Rect& glyphRect) const;
-	bool GetGlyphGeometry(int charCode, stbtt_packedchar &glyphGeometry) const;
+	bool GetGlyphRect(int charCode, SDL_Rect& glyphRect, int sizeIndex = 0) const;
+	bool GetGlyphGeometry(int charCode, stbtt_packedchar &glyphGeometry, int sizeIndex = 0) const;
 
 	/// Returns the internal surface that holds the glyphs.
 	/// Use GetGlyphGeometry() to find out coordinates of a glyph image in this surface.
 	SDL::Surface& GetSurface() { return *(fontSurface.get()); }
 
-	SDL_Rect ComputeTextSize(const std::wstring &text);
+	/// Width of the text (kerned) and height of its tallest glyph.
+	SDL_Rect ComputeTextSize(const std::wstring &text, int sizeIndex = 0);
+
+	/// Like the above, decoding the UTF-8 text as it goes.
+	SDL_Rect ComputeTextSize(const Utf8Text &text, int sizeIndex = 0);
+
+	/// Adjustment of the advance between two characters in pixels (0 unless both come from the same font).
+	float GetKerning(int left, int right, int sizeIndex = 0) const
+	{
+		return kerning.Get(uint32_t(left), uint32_t(right)) / 64.0f * GetKerningScale(sizeIndex);
+	}
+
+	/// Kerning among the glyphs of the largest size.
+	const KerningTable& GetKerningTable() const { return kerning; }
+
+	/// Factor from the kerning table to the kerning of the given size (kerning scales with the size).
+	float GetKerningScale(int sizeIndex) const { return fontSizes[sizeIndex] / GetKerningFontSize(); }
+
+	/**
+	 * Adds the glyphs of all characters of the text that are not encoded yet
+	 * (lazy fonts only; control characters are skipped). If the atlas runs out of space, it is rebuilt larger,
+	 * so previously returned glyph geometry must be queried again.
+	 * \return True if all glyphs are now available.
+	 */
+	bool AddGlyphs(const std::wstring &text);
+
+	/// Incremented whenever the contents of the atlas surface change.
+	int GetAtlasVersion() const { return atlasVersion; }
+
+	AtlasStats GetAtlasStats() const;
+
+	/// Returns true if the atlas was taken from the cache instead of being packed.
+	bool IsFromCache() const { return cachedAtlas != nullptr; }
+
+	AtlasMode GetAtlasMode() const { return atlasMode; }
+
+	/// Horizontal positions per pixel the glyphs can be drawn at (1 unless oversampled).
+	int GetSubpixelPhases() const { return subpixelPhases; }
+
+	/// A size the atlas was made for; glyph geometry of that size index is in pixels of this size.
+	float GetFontSize(int sizeIndex = 0) const { return fontSizes[sizeIndex]; }
+
+	/// Number of sizes in the atlas.
+	int GetSizeCount() const { return int(fontSizes.size()); }
+
+	/// The size the kerning table is for: the largest one, so that scaling it to the others
+	/// does not magnify its rounding.
+	float GetKerningFontSize() const { return *std::max_element(fontSizes.begin(), fontSizes.end()); }
+
+	/// Returns true if the atlas was baked into the executable.
+	bool IsBaked() const { return baked; }
+
+	/// Number of fonts in the fallback chain.
+	int GetFaceCount() const { return int(faces.size()); }
+
+	/// Returns the index of the first font of the chain that covers the codepoint, or -1 if none does.
+	int FindFace(uint32_t codepoint) const
+	{
+		for (size_t i = 0; i < faces.size(); i++) {
+			if (faces[i]->coverage.Contains(codepoint)) return int(i);
+		}
+		return -1;
+	}
 
 private:
 
-	const stbtt_packedchar* GetPackedChar(int charCode) const;
+	/// Glyphs that are packed from one font of the chain.
+	struct FaceRange {
+		int face;
+		stbtt_pack_range range;
+	};
+
+	/// Distance field of a glyph, waiting to be copied into the atlas.
+	struct SdfBitmap {
+		std::vector<uint8_t> pixels;
+		int width = 0;
+		int height = 0;
+		int xoff = 0;
+		int yoff = 0;
+		float xadvance = 0.0f;
+	};
+
+	/**
+	 * Extracts the kerning of the pairs that involve one of the added codepoints (sorted,
+	 * and encoded by now) from the fonts into the kerning table, which already has the pairs
+	 * among the other encoded glyphs.
+	 */
+	void AddKerning(const std::vector<int> &addedCodepoints);
+
+	/// Checks that there is at least one size and that all of them are positive.
+	bool InitFontSizes(const std::vector<float> &fontSizes_);
+
+	/// Checks the number of subpixel phases (which distance field atlases do not need).
+	bool InitSubpixelPhases(int subpixelPhases_);
+
+	/// Sets up the faces of the chain (unless their collections already have).
+	bool InitFaces(const std::vector<FontCollection::FaceRef> &fontFaces);
+
+	/// The font a codepoint is rendered from: the first one covering it, otherwise
+	/// the first one of the chain (which then renders its "missing glyph" box).
+	int SelectFace(uint32_t codepoint) const { return std::max(FindFace(codepoint), 0); }
+
+	/// Groups the codepoints by the font they are rendered from and creates a range for each group
+	/// and size, with the glyphs of size index s going into consecutive elements of packedChars
+	/// from s * codepoints.size() on.
+	std::vector<FaceRange> MakeFaceRanges(std::vector<int> &codepoints, stbtt_packedchar* packedChars) const;
+
+	/**
+	 * Measures the glyphs of all ranges into rects; returns the number of rects.
+	 * In kSdf mode, this already renders the distance fields (their size is not known before),
+	 * which are then kept in sdfs.
+	 */
+	int GatherRects(stbtt_pack_context &context, std::vector<FaceRange> &ranges, std::vector<stbrp_rect> &rects,
+		std::vector<SdfBitmap> &sdfs, int threadCount);
+
+	/// Renders the distance fields of the glyphs of the ranges using threadCount threads.
+	std::vector<SdfBitmap> RenderSdfs(std::vector<FaceRange> &ranges, int threadCount);
+
+	/// Copies the distance fields into their packed rects and fills in the glyph geometry.
+	bool CopySdfs(stbtt_pack_context &context, std::vector<FaceRange> &ranges,
+		std::vector<stbrp_rect> &rects, std::vector<SdfBitmap> &sdfs);
+
+	/// ComputeTextSize() for any sequence of codepoints.
+	template<class Text>
+	SDL_Rect MeasureText(const Text &text, int sizeIndex);
+
+	const stbtt_packedchar* GetPackedChar(int charCode, int sizeIndex) const;
+	stbtt_packedchar* GetPackedChar(int charCode, int sizeIndex);
+
+	/// Takes the atlas and glyph geometry from the cache entry, if there is a matching one.
+	bool LoadFromCache(const AtlasCache& atlasCache, const AtlasCache::Key& cacheKey);
+
+	/// Writes the packed atlas and glyph geometry to the cache.
+	bool StoreToCache(const AtlasCache& atlasCache, const AtlasCache::Key& cacheKey);
+
+	/**
+	 * Creates the atlas for the ranges: measures all glyphs, picks the smallest
+	 * near-square power-of-two size they fit in (growing it until they do),
+	 * and renders them using threadCount threads.
+	 */
+	bool BuildAtlas(std::vector<FaceRange> &ranges, int threadCount);
+
+	/// Places the glyphs of the ranges in the open atlas and renders them using threadCount threads.
+	bool PackAndRender(stbtt_pack_context &context, std::vector<FaceRange> &ranges, int threadCount);
+
+	/// Renders glyphs into rects that have already been packed.
+	bool RenderRects(stbtt_pack_context &context, std::vector<FaceRange> &ranges,
+		std::vector<stbrp_rect> &rects, int threadCount);
+
+	/// (Re)creates an empty square atlas for lazy packing, forgetting all lazy glyphs.
+	bool CreateLazyAtlas(int side);
+
+	/// Packs the given codepoints in all sizes into the lazy atlas; false if they do not all fit.
+	bool PackLazyGlyphs(std::vector<int> &codepoints);
 
 	uint32_t encodedCharsets = 0;
 	bool ok = false;
-	int encodedCharCount = 0;
+	std::vector<float> fontSizes;
+	int atlasVersion = 0;
+	int encodedCharCount = 0;		///< Per size.
+	int packAttempts = 0;
+	bool baked = false;
+	AtlasMode atlasMode = AtlasMode::kCoverage;
+	int subpixelPhases = 1;
+
+	/// Mapped cache file backing the pixels of fontSurface (if the atlas came from the cache).
+	std::unique_ptr<AtlasCache::Entry> cachedAtlas = nullptr;
+
 	std::unique_ptr<SDL::Surface> fontSurface = nullptr;
-	stbtt_fontinfo fontInfo = { 0 };
-	std::vector<stbtt_pack_range> packedCharRanges;
-	std::array<stbtt_packedchar, 767> packedCharsBasic;
-	std::array<stbtt_packedchar, 256> packedCharsCyrillic;
-	std::array<stbtt_packedchar, 143> packedCharsGreek;
+
+	/// The fallback chain, in order of preference (owned by their collections).
+	std::vector<const FontCollection::Face*> faces;
+
+	/// Geometry of the encoded glyphs of all sizes; slot 0 is unused, as 0 in glyphIndices means "not encoded".
+	std::vector<stbtt_packedchar> glyphs;
+
+	/// For each size, maps codepoints to their slots in glyphs.
+	std::vector<CodepointTable> glyphIndices;
+
+	/// Kerning among the encoded glyphs at the largest size, extracted once when the atlas is built.
+	KerningTable kerning;
+
+	/// Lazy mode: the atlas stays open for packing more glyphs.
+	bool lazy = false;
+	bool packContextOpen = false;
+	stbtt_pack_context packContext = { 0 };
 };
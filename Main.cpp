@@ -1,13 +1,23 @@
 #include "MapFile.h"
 #include "LoadFont.h"
 #include "ToUnicode.h"
+#include "FontIndex.h"
+#include "FontCollection.h"
+#include "BakedAtlas.h"
+#include "SdfRender.h"
+#include "SubpixelRender.h"
+#include "TextLayout.h"
+#include "TextBlock.h"
+#include "GlyphBatch.h"
+#include "CoverageBlend.h"
 #include "SDL.h"
 #include "SDLWrapper.h"
 #include <memory>
 #include <array>
+#include <vector>
+#include <algorithm>
 #include <iostream>
 #include <string.h>
-#include <locale>
 #include <sstream>
 
 const char* DEFAULT_TITLE = "sdlmessage";
@@ -15,18 +25,36 @@ const int DEFAULT_WINDOW_WIDTH = 1024;
 const int DEFAULT_WINDOW_HEIGHT = 256;
 const int DISPLAY_NUMBER = 0;
 
-std::array<const char*, 2> FONT_FILE_CANDIDATES = {
-	"/usr/share/fonts/TTF/DejaVuSans.ttf",		// Arch-ism
-	"/usr/share/fonts/dejavu/DejaVuSans.ttf"	// Fedora
-};
+// the text is wrapped to the window width less this on either side
+const int TEXT_MARGIN = 8;
+
+// glyph quads are tinted with this, and the CPU composing path blends it over the background
+const SDL_Color TEXT_COLOR = { 0xff, 0xff, 0xff, 0xff };
+const SDL_Color BACKGROUND_COLOR = { 0x0f, 0x0f, 0x0f, 0xff };
+
+// gamma of the display assumed by --gamma-correct
+const float DISPLAY_GAMMA = 2.2f;
+
+// used unless a font is given explicitly (and if it is not installed, whatever font covers the message)
+const char* DEFAULT_FONT_FAMILY = "DejaVu Sans";
+
+const float DEFAULT_FONT_SIZE = 32.0f;
+
+// resolution of distance field atlases, which are then drawn at any size
+const float SDF_ATLAS_FONT_SIZE = 48.0f;
+const uint32_t DEFAULT_CHARSETS = Font::kCharsetLatin|Font::kCharsetCyrillic|Font::kCharsetGreek;
+
+// how many installed fonts may be added for characters the main font lacks
+const int MAX_FALLBACK_FONTS = 4;
 
 //---
 
 void ShowUsage()
 {
 	std::cerr << "Usage:" << std::endl;
-	std::cerr << "    sdlmessage [options] message" << std::endl << std::endl;
-	std::cerr << "Shows a short, single-line message in a window and waits for the window to be closed." << std::endl << std::endl;
+	std::cerr << "    sdlmessage [options] message" << std::endl;
+	std::cerr << "    sdlmessage [options] --file <path>" << std::endl << std::endl;
+	std::cerr << "Shows a message in a window (wrapped to its width) and waits for the window to be closed." << std::endl << std::endl;
 	std::cerr << "Options:" << std::endl;
 	std::cerr << "    --help             Shows this help text (also shown on unrecognized input)" << std::endl;
 	std::cerr << "    --x                X coordinate of the window" << std::endl;
@@ -34,10 +62,45 @@ void ShowUsage()
 	std::cerr << "    --no-border        Show a borderless window (press Esc to dismiss it)" << std::endl;
 	std::cerr << "    --width <width>    Explicitly sets the window width" << std::endl;
 	std::cerr << "    --height <height>  Explicitly sets the window height" << std::endl;
-	std::cerr << "    --font <path>      Complete path to font to use" << std::endl;
+	std::cerr << "    --file <path>      Read the message from a file (- for standard input)" << std::endl;
+	std::cerr << "    --font <path>      Complete path to font to use (repeat to add fallback fonts; - for standard input;" << std::endl;
+	std::cerr << "                       path.ttc#N selects face N of a collection)" << std::endl;
+	std::cerr << "    --font-family <name>  Family name of an installed font to use" << std::endl;
+	std::cerr << "    --font-size <px>   Size of the text in pixels (default 32)" << std::endl;
+	std::cerr << "    --sdf              Use a distance field atlas, shared by all text sizes" << std::endl;
+	std::cerr << "    --subpixel <n>     Place glyphs at 1/n pixel steps (2 to 4; n times the atlas size)" << std::endl;
 	std::cerr << "    --close-on-click   Clicking in the window closes it" << std::endl;
 	std::cerr << "    --close-on-key     Any key causes the window to close" << std::endl;
 	std::cerr << "    --close-after      Close automatically after given number of milliseconds" << std::endl;
+	std::cerr << "    --lazy-glyphs      Rasterize only the characters used in the message (any script)" << std::endl;
+	std::cerr << "    --font-access <how>  How to read the font files in: default, populate (all at once)," << std::endl;
+	std::cerr << "                       willneed (all in the background), sequential, random, or tables" << std::endl;
+	std::cerr << "                       (only the tables needed for rendering, all at once)" << std::endl;
+	std::cerr << "    --cpu-compose      Compose the text into one texture on the CPU instead of" << std::endl;
+	std::cerr << "                       drawing glyph quads from the atlas texture" << std::endl;
+	std::cerr << "    --gamma-correct    Blend composed text as if in linear light (with --cpu-compose or --sdf)" << std::endl;
+	std::cerr << "    --verbose          Print statistics about the glyph atlas and font loading" << std::endl;
+	std::cerr << "    --no-atlas-cache   Always rasterize the font instead of using the on-disk glyph cache" << std::endl;
+}
+
+//---
+
+/// A face of a font file, as given on the command line ("path" or "path#N") or found in the index.
+struct FaceSpec {
+	std::string path;
+	int faceIndex = 0;
+};
+
+/// Splits "path#N" into the path and the face index; anything else is all path.
+FaceSpec ParseFaceSpec(const std::string& arg)
+{
+	size_t hash = arg.rfind('#');
+	if (hash == std::string::npos || hash == 0 || hash + 1 == arg.size()
+		|| arg.find_first_not_of("0123456789", hash + 1) != std::string::npos
+	) {
+		return FaceSpec { arg, 0 };
+	}
+	return FaceSpec { arg.substr(0, hash), std::stoi(arg.substr(hash + 1)) };
 }
 
 //---
@@ -51,12 +114,24 @@ public:
 	bool noBorder = false;
 	bool closeOnClick = false;
 	bool closeOnKey = false;
+	bool noAtlasCache = false;
+	bool verbose = false;
+	bool cpuCompose = false;
+	bool gammaCorrect = false;
 	int explicitWidth = -1;
 	int explicitHeight = -1;
 	int windowX = -1;
 	int windowY = -1;
 	int32_t closingDelay = -1;
-	std::string explicitFont;
+	bool lazyGlyphs = false;
+	bool sdfAtlas = false;
+	int subpixelPhases = 1;
+	ByteSource::Access fontAccess = ByteSource::Access::kDefault;
+	float fontSize = DEFAULT_FONT_SIZE;
+	std::vector<FaceSpec> explicitFonts;
+	std::string fontFamily;
+	std::string message;
+	std::string messageFile;
 
 	CommandLineOptions(int argc, const char** argv);
 };
@@ -72,9 +147,26 @@ enum class ValueExpected {
 	kWindowWidth,
 	kWindowHeight,
 	kClosingDelay,
+	kFontSize,
+	kSubpixelPhases,
 
 	// string values
-	kFont = 100
+	kFont = 100,
+	kFontFamily,
+	kFontAccess,
+	kMessageFile
+};
+
+//---
+
+/// Names of the ByteSource::Access modes on the command line.
+const std::pair<const char*, ByteSource::Access> FONT_ACCESS_NAMES[] = {
+	{ "default", ByteSource::Access::kDefault },
+	{ "populate", ByteSource::Access::kPopulate },
+	{ "willneed", ByteSource::Access::kWillNeed },
+	{ "sequential", ByteSource::Access::kSequential },
+	{ "random", ByteSource::Access::kRandom },
+	{ "tables", ByteSource::Access::kFontTables }
 };
 
 //---
@@ -84,12 +176,26 @@ CommandLineOptions::CommandLineOptions(int argc, const char** argv)
 	// what value is expected after this argument
 	auto expected = ValueExpected::kNone;
 
-	std::string rawMessage;
 	for (int i = 1; i < argc; i++) {
 		std::string arg(argv[i]);
 		if (expected != ValueExpected::kNone) {
 			if (expected == ValueExpected::kFont) {
-				explicitFont = arg;
+				explicitFonts.push_back(ParseFaceSpec(arg));
+			}
+			else if (expected == ValueExpected::kFontFamily) {
+				fontFamily = arg;
+			}
+			else if (expected == ValueExpected::kMessageFile) {
+				messageFile = arg;
+			}
+			else if (expected == ValueExpected::kFontAccess) {
+				auto name = std::find_if(std::begin(FONT_ACCESS_NAMES), std::end(FONT_ACCESS_NAMES),
+					[&arg](const std::pair<const char*, ByteSource::Access>& entry) { return arg == entry.first; });
+				if (name == std::end(FONT_ACCESS_NAMES)) {
+					std::cerr << "error: unknown font access mode: " << arg << std::endl;
+					return;
+				}
+				fontAccess = name->second;
 			}
 			else {
 				try {
@@ -118,6 +224,20 @@ CommandLineOptions::CommandLineOptions(int argc, const char** argv)
 						case ValueExpected::kClosingDelay:
 							closingDelay = value;
 							break;
+						case ValueExpected::kFontSize:
+							if (value <= 0 || value > 1024) {
+								std::cerr << "error: font size out of bounds" << std::endl;
+								return;
+							}
+							fontSize = float(value);
+							break;
+						case ValueExpected::kSubpixelPhases:
+							if (value < 1 || value > Font::kMaxSubpixelPhases) {
+								std::cerr << "error: subpixel phases out of bounds" << std::endl;
+								return;
+							}
+							subpixelPhases = value;
+							break;
 					}
 				}
 				catch (std::invalid_argument &ex) {
@@ -142,6 +262,24 @@ CommandLineOptions::CommandLineOptions(int argc, const char** argv)
 		else if (arg == "--close-on-key") {
 			closeOnKey = true;
 		}
+		else if (arg == "--lazy-glyphs") {
+			lazyGlyphs = true;
+		}
+		else if (arg == "--sdf") {
+			sdfAtlas = true;
+		}
+		else if (arg == "--cpu-compose") {
+			cpuCompose = true;
+		}
+		else if (arg == "--gamma-correct") {
+			gammaCorrect = true;
+		}
+		else if (arg == "--verbose") {
+			verbose = true;
+		}
+		else if (arg == "--no-atlas-cache") {
+			noAtlasCache = true;
+		}
 		else if (arg == "--close-after") {
 			expected = ValueExpected::kClosingDelay;
 		}
@@ -160,18 +298,43 @@ CommandLineOptions::CommandLineOptions(int argc, const char** argv)
 		else if (arg == "--font") {
 			expected = ValueExpected::kFont;
 		}
+		else if (arg == "--font-family") {
+			expected = ValueExpected::kFontFamily;
+		}
+		else if (arg == "--font-size") {
+			expected = ValueExpected::kFontSize;
+		}
+		else if (arg == "--subpixel") {
+			expected = ValueExpected::kSubpixelPhases;
+		}
+		else if (arg == "--font-access") {
+			expected = ValueExpected::kFontAccess;
+		}
+		else if (arg == "--file") {
+			expected = ValueExpected::kMessageFile;
+		}
 		else {
-			if (!rawMessage.empty()) {
+			if (!message.empty()) {
 				std::cerr << "error: unrecognized argument #" << i << std::endl;
 				return;
 			}
-			rawMessage = arg;
+			message = arg;
 		}
 	}
-	if (rawMessage.empty()) {
+	if (message.empty() && messageFile.empty()) {
 		std::cerr << "error: no message was specified" << std::endl;
 		return;
 	}
+	if (!message.empty() && !messageFile.empty()) {
+		std::cerr << "error: both a message and a message file were specified" << std::endl;
+		return;
+	}
+	if (messageFile == "-" && std::any_of(explicitFonts.begin(), explicitFonts.end(),
+		[](const FaceSpec& font) { return font.path == "-"; })
+	) {
+		std::cerr << "error: the message and a font cannot both come from standard input" << std::endl;
+		return;
+	}
 
 	ok = true;
 }
@@ -186,15 +349,49 @@ int main(int argc, const char** argv)
 		return 127;
 	}
 
-	// set locale (important otherwise the default is C and we don't have Unicode!)
-	std::locale::global(std::locale("en_US.UTF-8"));
-
 	CommandLineOptions options(argc, argv);
 	if (options.helpShown) return 0;
 	if (!options.ok) { ShowUsage(); return 1; }
 
-	// load the message text and convert it from multibyte to Unicode codepoints
-	std::wstring messageText = MultibyteToWideString(argv[1]);
+	// load the message text and check that it is UTF-8; it is decoded only as it is laid out,
+	// straight from the argument or the file (a message file may be a pipe, so it is not necessarily mapped)
+	std::unique_ptr<ByteSource> messageFile;
+	Utf8Text messageText;
+	if (!options.messageFile.empty()) {
+		messageFile = ByteSource::Open(options.messageFile.c_str(), ByteSource::Access::kSequential);
+		if (!messageFile->Ok()) {
+			std::cerr << "Could not read message file: " << SDL_GetError() << std::endl;
+			return 127;
+		}
+
+		// the line break that ends the last line of a text file is not part of the message
+		size_t length = messageFile->GetSize();
+		const char* bytes = reinterpret_cast<const char*>(messageFile->GetData());
+		while (length > 0 && (bytes[length - 1] == '\n' || bytes[length - 1] == '\r')) {
+			length--;
+		}
+		size_t errorOffset = ValidateUtf8(bytes, length);
+		if (errorOffset != kUtf8Valid) {
+			std::cerr << "error: the message file is not valid UTF-8 (at byte " << errorOffset << ")" << std::endl;
+			return 1;
+		}
+		if (length == 0) {
+			std::cerr << "error: the message file is empty" << std::endl;
+			return 1;
+		}
+		messageText = Utf8Text(bytes, length);
+	}
+	else {
+		size_t errorOffset = ValidateUtf8(options.message.data(), options.message.size());
+		if (errorOffset != kUtf8Valid) {
+			std::cerr << "error: the message is not valid UTF-8 (at byte " << errorOffset << ")" << std::endl;
+			return 1;
+		}
+		messageText = Utf8Text(options.message.data(), options.message.size());
+	}
+
+	// choosing and loading fonts only needs to know which characters there are
+	const std::wstring messageCharacters = messageText.GetCharacterSet();
 
 	SDL_Rect displayUsableBounds;
 	SDL_GetDisplayUsableBounds(DISPLAY_NUMBER, &displayUsableBounds);
@@ -221,69 +418,285 @@ int main(int argc, const char** argv)
 		return 127;
 	}
 
-	// load the font; if no font is given explicitly, try multiple usual locations
-	std::unique_ptr<MappedFile> fontFile;
-	if (!options.explicitFont.empty()) {
-		fontFile.reset(new MappedFile(options.explicitFont.c_str()));
+	// page faults taken while the font is loaded show what reading the font files costs
+	MappedFile::PageFaults faultsBeforeLoading = MappedFile::PageFaults::Now();
+
+	// the atlas baked in at build time serves the default settings without touching any font file,
+	// as long as it has all characters of the message
+	std::unique_ptr<Font> font;
+	const BakedAtlas* bakedAtlas = GetBakedAtlas();
+	if (bakedAtlas && options.explicitFonts.empty() && options.fontFamily.empty() && !options.lazyGlyphs
+		&& !options.sdfAtlas && options.subpixelPhases == 1
+		&& bakedAtlas->fontSize == options.fontSize && bakedAtlas->charsets == DEFAULT_CHARSETS
+	) {
+		font.reset(new Font(*bakedAtlas));
+		bool complete = std::all_of(messageCharacters.begin(), messageCharacters.end(), [&font](wchar_t c) {
+			stbtt_packedchar glyphGeometry;
+			return IsControlCharacter(c) || font->GetGlyphGeometry(int(c), glyphGeometry);
+		});
+		if (!font->Ok() || !complete) {
+			font.reset();
+		}
 	}
-	else {
-		for (auto candidateFile : FONT_FILE_CANDIDATES) {
-			fontFile.reset(new MappedFile(candidateFile));
-			if (fontFile->Ok()) break;		// candidate successful
+
+	std::vector<std::unique_ptr<ByteSource>> fontFiles;
+	std::vector<std::unique_ptr<FontCollection>> fontCollections;
+	std::vector<FontCollection::FaceRef> fontChain;
+	std::unique_ptr<AtlasCache> atlasCache;
+	if (!font) {
+		// load the fonts; if no font file is given explicitly, look them up among the installed ones
+		// (the index is built on the first run and reused until a font directory changes)
+		std::vector<FaceSpec> faces;
+		if (!options.explicitFonts.empty()) {
+			faces = options.explicitFonts;
+		}
+		else {
+			FontIndex fontIndex;
+			FontIndex::Face face;
+			bool found = false;
+			if (!options.fontFamily.empty()) {
+				found = fontIndex.FindByFamily(options.fontFamily, face);
+			}
+			else {
+				found = fontIndex.FindByFamily(DEFAULT_FONT_FAMILY, face)
+					|| fontIndex.FindByCoverage(messageCharacters, face);
+			}
+			if (!found) {
+				std::cerr << "Could not find a suitable font among " << fontIndex.GetFaceCount() << " installed faces" << std::endl;
+				return 127;
+			}
+
+			// characters the chosen font lacks are taken from other installed fonts
+			std::vector<FontIndex::Face> chain = { face };
+			while (chain.size() <= MAX_FALLBACK_FONTS) {
+				std::wstring uncovered;
+				for (wchar_t c : messageCharacters) {
+					if (IsControlCharacter(c)) continue;
+					bool covered = std::any_of(chain.begin(), chain.end(), [c](const FontIndex::Face& f) {
+						return f.Covers(uint32_t(c));
+					});
+					if (!covered) uncovered += c;
+				}
+				FontIndex::Face fallback;
+				if (uncovered.empty() || !fontIndex.FindByCoverage(uncovered, fallback)) break;
+				chain.push_back(fallback);
+			}
+
+			if (options.verbose && fontIndex.WasRebuilt()) {
+				std::cerr << "font index rebuilt" << std::endl;
+			}
+			for (const FontIndex::Face& f : chain) {
+				if (options.verbose) {
+					std::cerr << (faces.empty() ? "font: " : "fallback font: ")
+						<< f.family << " " << f.style << " (" << f.path;
+					if (f.faceIndex != 0) {
+						std::cerr << "#" << f.faceIndex;
+					}
+					std::cerr << ")" << std::endl;
+				}
+				faces.push_back(FaceSpec { f.path, f.faceIndex });
+			}
+		}
+
+		// every file is opened once, however many of its faces the chain uses
+		for (const FaceSpec& face : faces) {
+			size_t file = 0;
+			while (file < fontFiles.size() && fontFiles[file]->GetFileName() != face.path) {
+				file++;
+			}
+			if (file == fontFiles.size()) {
+				fontFiles.push_back(ByteSource::Open(face.path.c_str(), options.fontAccess));
+				if (!fontFiles.back()->Ok()) {
+					std::cerr << "Could not open font file: " << SDL_GetError() << std::endl;
+					return 127;
+				}
+				fontCollections.emplace_back(new FontCollection(*fontFiles.back()));
+				if (!fontCollections.back()->Ok()) {
+					std::cerr << "Not a font file: " << face.path << std::endl;
+					return 127;
+				}
+			}
+			fontChain.push_back(FontCollection::FaceRef(fontCollections[file].get(), face.faceIndex));
+		}
+
+		// packed atlases are cached on disk, so that repeated runs skip rasterization
+		if (!options.noAtlasCache) {
+			atlasCache.reset(new AtlasCache());
+		}
+
+		// a lazy font holds just the glyphs of the message, the default one whole charsets;
+		// a distance field atlas has a fixed resolution whatever the size of the text
+		Font::AtlasMode atlasMode = options.sdfAtlas ? Font::AtlasMode::kSdf : Font::AtlasMode::kCoverage;
+		float atlasFontSize = options.sdfAtlas ? SDF_ATLAS_FONT_SIZE : options.fontSize;
+		if (options.lazyGlyphs) {
+			font.reset(new Font(fontChain, atlasFontSize, messageCharacters, atlasMode, options.subpixelPhases));
+		}
+		else {
+			font.reset(new Font(fontChain, atlasFontSize, DEFAULT_CHARSETS, atlasCache.get(), 0, atlasMode,
+				options.subpixelPhases));
 		}
 	}
-	if (!fontFile->Ok()) {
-		std::cerr << "Could not open font file: " << SDL_GetError() << std::endl;
+	if (!font->Ok()) {
+		std::cerr << "Could not load font: " << SDL_GetError() << std::endl;
 		return 127;
 	}
+	if (options.verbose) {
+		Font::AtlasStats stats = font->GetAtlasStats();
+		std::cerr << "atlas: " << stats.width << "x" << stats.height
+			<< ", " << stats.glyphCount << " glyphs"
+			<< ", " << int(stats.efficiency * 100.0 + 0.5) << "% filled";
+		if (font->GetSubpixelPhases() > 1) {
+			std::cerr << ", " << font->GetSubpixelPhases() << " subpixel phases";
+		}
+		if (font->IsBaked()) {
+			std::cerr << ", baked into the executable";
+		}
+		else if (font->IsFromCache()) {
+			std::cerr << ", from cache";
+		}
+		else {
+			std::cerr << ", " << stats.packAttempts << " packing attempt(s)";
+		}
+		std::cerr << std::endl;
+
+		MappedFile::PageFaults faults = MappedFile::PageFaults::Now() - faultsBeforeLoading;
+		size_t fontBytes = 0, residentBytes = 0;
+		for (const std::unique_ptr<ByteSource>& fontFile : fontFiles) {
+			fontBytes += fontFile->GetSize();
+			residentBytes += fontFile->GetResidentSize();
+		}
+		std::cerr << "font loading: " << faults.minor << " minor and " << faults.major << " major page faults"
+			<< ", " << residentBytes / 1024 << " of " << fontBytes / 1024 << " KiB of font files in memory"
+			<< std::endl;
+	}
 
-	Font font(*fontFile, 32.0f, Font::kCharsetCyrillic|Font::kCharsetGreek);
-	if (!font.Ok()) {
-		std::cerr << "Could not load font: " << SDL_GetError() << std::endl;
-		return 127;
+	// distance field glyphs are scaled to the requested size, the others are drawn as they are
+	const bool sdf = (font->GetAtlasMode() == Font::AtlasMode::kSdf);
+	const float scale = sdf ? options.fontSize / font->GetFontSize() : 1.0f;
+
+	// glyphs are drawn as quads straight from the atlas, unless they have to be composed
+	// on the CPU into a texture of the text (distance fields, or SDL older than 2.0.18)
+	std::unique_ptr<GlyphBatch> glyphBatch;
+	if (!sdf && !options.cpuCompose) {
+		glyphBatch.reset(new GlyphBatch(renderer, *font));
+		if (!glyphBatch->Ok()) {
+			if (options.verbose) {
+				std::cerr << "composing on the CPU: " << SDL_GetError() << std::endl;
+			}
+			glyphBatch.reset();
+		}
 	}
 
-	SDL::Surface messageSurface(windowWidth, windowHeight, 32, SDL_PIXELFORMAT_RGBA32);
-	if (!messageSurface.Ok()) {
-		std::cerr << "Could not create surface: " << SDL_GetError() << std::endl;
-		return 127;
+	// wrap the text to the window, then center each line and the block of lines;
+	// lines that repeat (as in logs) are laid out once, through the cache
+	LayoutCache layoutCache;
+	TextBlock textBlock(*font, scale, 0, &layoutCache);
+	textBlock.SetText(messageText);
+	textBlock.SetWidth(windowWidth - 2 * TEXT_MARGIN);
+	SDL_Rect blockBounds = textBlock.GetBounds();
+	int blockBaselineY = windowHeight/2 - blockBounds.h/2 - blockBounds.y;
+	if (blockBounds.h > windowHeight - 2 * TEXT_MARGIN) {
+		// a block taller than the window starts at the top, so that the message is read from its beginning
+		blockBaselineY = TEXT_MARGIN - blockBounds.y;
 	}
+	auto lineStartX = [windowWidth](const WrappedLine& line) {
+		return windowWidth/2 - line.bounds.w/2 - line.bounds.x;
+	};
 
-	SDL_Rect textRect = font.ComputeTextSize(messageText);
-	int startX = windowWidth/2 - textRect.w/2;
-	int startY = windowHeight/2 - textRect.h/2;
-
-	int x = startX;
-	for (int i = 0; i < messageText.size(); i++) {
-		stbtt_packedchar glyphGeometry;
-		if (font.GetGlyphGeometry(int(messageText[i]), glyphGeometry)) {
-			SDL::Rect glyphRect(
-				glyphGeometry.x0,
-				glyphGeometry.y0,
-				glyphGeometry.x1 - glyphGeometry.x0,
-				glyphGeometry.y1 - glyphGeometry.y0
-			);
-			SDL::Rect destRect(
-				x + glyphGeometry.xoff,
-				startY + glyphGeometry.yoff,
-				glyphGeometry.x1 - glyphGeometry.x0,
-				glyphGeometry.y1 - glyphGeometry.y0
-			);
-			if (!font.GetSurface().Blit(glyphRect, messageSurface, destRect)) {
-				std::cerr << "Could not blit glyph: " << SDL_GetError() << std::endl;
-				break;
+	// composed text only takes the box its visible glyphs cover (with a pixel to spare for subpixel
+	// rounding), which is then placed in the window; the rest of the window is just cleared;
+	// glyphs are blended straight into the locked texture, in the renderer's own pixel format
+	SDL_Rect textBox = { 0, 0, 0, 0 };
+	std::unique_ptr<SDL::StreamingTexture> messageTexture;
+	std::unique_ptr<SDL::Surface> messageSurface;
+	std::unique_ptr<CoverageBlend> textBlend;
+	if (!glyphBatch) {
+		int left = windowWidth, top = windowHeight, right = 0, bottom = 0;
+		for (const WrappedLine& line : textBlock.GetLines()) {
+			if (line.bounds.w <= 0 || line.bounds.h <= 0) continue;
+			int lineLeft = lineStartX(line) + line.bounds.x;
+			int lineTop = blockBaselineY + line.baselineY + line.bounds.y;
+			left = std::min(left, lineLeft - 1);
+			top = std::min(top, lineTop - 1);
+			right = std::max(right, lineLeft + line.bounds.w + 1);
+			bottom = std::max(bottom, lineTop + line.bounds.h + 1);
+		}
+		left = std::max(left, 0);
+		top = std::max(top, 0);
+		right = std::min(right, windowWidth);
+		bottom = std::min(bottom, windowHeight);
+		if (right > left && bottom > top) {
+			textBox = SDL_Rect { left, top, right - left, bottom - top };
+			messageTexture.reset(new SDL::StreamingTexture(renderer, SDL::StreamingTexture::GetNativeFormat(renderer),
+				textBox.w, textBox.h));
+			if (!messageTexture->Ok() || !messageTexture->Lock()) {
+				std::cerr << "Could not create message texture: " << SDL_GetError() << std::endl;
+				return 127;
+			}
+			messageSurface.reset(new SDL::Surface(messageTexture->GetPixels(), textBox.w, textBox.h, 32,
+				messageTexture->GetPitch(), messageTexture->GetFormat()));
+			if (!messageSurface->Ok()) {
+				std::cerr << "Could not create surface: " << SDL_GetError() << std::endl;
+				return 127;
+			}
+
+			// the locked pixels are undefined, so all of them start as the background
+			// (the box is then opaque, and blending it into the window is not needed)
+			const SDL_PixelFormat* format = messageSurface->GetFormat();
+			SDL_FillRect(*messageSurface, nullptr,
+				SDL_MapRGBA(format, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, BACKGROUND_COLOR.a));
+			SDL_SetTextureBlendMode(*messageTexture, SDL_BLENDMODE_NONE);
+			if (options.gammaCorrect) {
+				textBlend.reset(new CoverageBlend(format, TEXT_COLOR, BACKGROUND_COLOR, DISPLAY_GAMMA));
+			}
+			else {
+				textBlend.reset(new CoverageBlend(format, TEXT_COLOR));
+			}
+			if (options.verbose) {
+				std::cerr << "composing with the " << CoverageBlend::GetKernelName() << " blend kernel" << std::endl;
 			}
-			x += glyphGeometry.xadvance;
 		}
 	}
 
-	SDL::Texture messageTexture(renderer, messageSurface);
-	if (!messageTexture.Ok()) {
-		std::cerr << "Could not create message texture: " << SDL_GetError() << std::endl;
-		return 127;
+	const int subpixelPhases = font->GetSubpixelPhases();
+	for (const WrappedLine& line : textBlock.GetLines()) {
+		int baselineY = blockBaselineY + line.baselineY;
+
+		// lines outside the window are not drawn
+		if (baselineY + line.bounds.y >= windowHeight) break;
+		if (baselineY + line.bounds.y + line.bounds.h <= 0) continue;
+
+		int startX = lineStartX(line);
+		const GlyphRun& run = textBlock.GetRun(line);
+		for (int i = line.firstGlyph; i < line.firstGlyph + line.glyphCount; i++) {
+			const PositionedGlyph& glyph = run.glyphs[i];
+			const stbtt_packedchar& glyphGeometry = glyph.geometry;
+			// relative to its line, a glyph is within the window width (the line is wrapped to it)
+			int32_t penX = PixelsToPen(float(startX)) + int32_t(glyph.x - line.startX);
+			if (glyphBatch) {
+				glyphBatch->AddGlyph(run, glyph, penX, baselineY, TEXT_COLOR);
+				continue;
+			}
+			if (!messageSurface) break;
+
+			// the message surface starts at the corner of the text box
+			int32_t surfacePenX = penX - PixelsToPen(float(textBox.x));
+			int surfaceBaselineY = baselineY - textBox.y;
+			if (sdf) {
+				DrawSdfGlyph(font->GetSurface(), glyphGeometry, scale, *messageSurface, PenToPixels(surfacePenX),
+					surfaceBaselineY, *textBlend);
+			}
+			else {
+				DrawSubpixelGlyph(font->GetSurface(), glyphGeometry, subpixelPhases, *messageSurface, surfacePenX,
+					surfaceBaselineY, *textBlend);
+			}
+		}
 	}
 
-	messageSurface.Discard();
+	if (messageTexture) {
+		messageSurface.reset();
+		messageTexture->Unlock();
+	}
 
 	SDL::EventLoop eventLoop(libSDL);
 
@@ -295,10 +708,17 @@ int main(int argc, const char** argv)
 		}));
 	};
 
-	eventLoop.OnRedraw = [&renderer, &messageTexture](){
-		SDL_SetRenderDrawColor(renderer, 0x0f, 0x0f, 0x0f, 0x00);
+	eventLoop.OnRedraw = [&renderer, &messageTexture, &glyphBatch, textBox](){
+		SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 0x00);
 		SDL_RenderClear(renderer);
-		SDL_RenderCopy(renderer, messageTexture, NULL, NULL);
+		if (glyphBatch) {
+			if (!glyphBatch->Draw()) {
+				std::cerr << "Could not draw glyphs: " << SDL_GetError() << std::endl;
+			}
+		}
+		else if (messageTexture) {
+			SDL_RenderCopy(renderer, *messageTexture, NULL, &textBox);
+		}
 		SDL_RenderPresent(renderer);
 	};
 	eventLoop.OnKey = [&eventLoop, options](const SDL_KeyboardEvent &event) {
@@ -1,13 +1,69 @@
 #include "MapFile.h"
 #include "SDL.h"
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
-MappedFile::MappedFile(const char* fileName)
+namespace {
+
+uint16_t ReadU16(const uint8_t* p) { return uint16_t((p[0] << 8) | p[1]); }
+uint32_t ReadU32(const uint8_t* p) { return (uint32_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+/// Tables that rasterization, coverage and kerning read; the others (names, hinting, color...) are not needed.
+const char* const kPrefetchedTables[] = { "cmap", "loca", "glyf", "hmtx", "kern", "GPOS" };
+
+size_t PageSize()
+{
+	static const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+	return pageSize;
+}
+
+/// A part of the file, extended to whole pages.
+struct PageRange {
+	size_t begin;
+	size_t end;
+};
+
+PageRange ToPages(size_t offset, size_t length, size_t byteSize)
+{
+	size_t pageSize = PageSize();
+	size_t end = std::min(offset + length, byteSize);
+	return PageRange { offset & ~(pageSize - 1), end };
+}
+
+/// Waits for the pages by reading a byte from each of them.
+void TouchPages(const uint8_t* data, const PageRange& range)
+{
+	volatile uint8_t sink = 0;
+	for (size_t i = range.begin; i < range.end; i += PageSize()) {
+		sink = sink + data[i];
+	}
+}
+
+} // namespace
+
+//---
+
+MappedFile::PageFaults MappedFile::PageFaults::Now()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return PageFaults();
+	}
+	return PageFaults { uint64_t(usage.ru_minflt), uint64_t(usage.ru_majflt) };
+}
+
+//---
+
+MappedFile::MappedFile(const char* fileName_, Access access)
+	: ByteSource(fileName_)
 {
-	int f = open(fileName, O_RDONLY);
+	int f = open(fileName.c_str(), O_RDONLY);
 	if (f < 0) {
 		SDL_SetError("open() failed");
 		return;
@@ -22,8 +78,15 @@ MappedFile::MappedFile(const char* fileName)
 
 	size_t mappedSize = fileMetadata.st_size;
 
-	data = static_cast<uint8_t*>(mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, f, 0));
-	if (data == MAP_FAILED) {
+	if (mappedSize == 0) {
+		SDL_SetError("file is empty");
+		close(f);
+		return;
+	}
+
+	int flags = MAP_PRIVATE | (access == Access::kPopulate ? MAP_POPULATE : 0);
+	void* mapping = mmap(nullptr, mappedSize, PROT_READ, flags, f, 0);
+	if (mapping == MAP_FAILED) {
 		SDL_SetError("mmap() failed");
 		close(f);
 		return;
@@ -31,8 +94,29 @@ MappedFile::MappedFile(const char* fileName)
 
 	close(f);	// no more needed, mapping persists
 
-	data = data;
+	data = static_cast<uint8_t*>(mapping);
 	byteSize = mappedSize;
+	device = fileMetadata.st_dev;
+	inode = fileMetadata.st_ino;
+	modificationTime = int64_t(fileMetadata.st_mtim.tv_sec) * 1000000000 + fileMetadata.st_mtim.tv_nsec;
+
+	// the advice is only a hint, so a kernel that does not take it changes nothing
+	switch (access) {
+		case Access::kWillNeed:
+			madvise(data, byteSize, MADV_WILLNEED);
+			break;
+		case Access::kSequential:
+			madvise(data, byteSize, MADV_SEQUENTIAL);
+			break;
+		case Access::kRandom:
+			madvise(data, byteSize, MADV_RANDOM);
+			break;
+		case Access::kFontTables:
+			PrefetchFontTables();
+			break;
+		default:
+			break;
+	}
 }
 
 MappedFile::~MappedFile()
@@ -42,9 +126,73 @@ MappedFile::~MappedFile()
 
 void MappedFile::Unmap()
 {
-	if (!data) {
+	if (data) {
 		munmap(data, byteSize);
 	}
 	data = nullptr;
 	byteSize = 0;
 }
+
+size_t MappedFile::GetResidentSize() const
+{
+	if (!data) return 0;
+
+	size_t pageSize = PageSize();
+	std::vector<unsigned char> residency((byteSize + pageSize - 1) / pageSize);
+	if (mincore(data, byteSize, residency.data()) != 0) return 0;
+
+	size_t residentPages = 0;
+	for (unsigned char page : residency) {
+		residentPages += (page & 1);
+	}
+	return residentPages * pageSize;
+}
+
+void MappedFile::Prefetch(size_t offset, size_t length)
+{
+	if (!data || offset >= byteSize) return;
+
+	PageRange range = ToPages(offset, length, byteSize);
+	madvise(data + range.begin, range.end - range.begin, MADV_WILLNEED);
+	TouchPages(data, range);
+}
+
+void MappedFile::PrefetchFontTables()
+{
+	// the directory of every font of a collection, or just the one of a plain font
+	std::vector<uint32_t> fontOffsets;
+	if (byteSize >= 12 && memcmp(data, "ttcf", 4) == 0) {
+		uint32_t fontCount = ReadU32(data + 8);
+		for (uint32_t i = 0; i < fontCount && 12 + 4 * (i + 1) <= byteSize; i++) {
+			fontOffsets.push_back(ReadU32(data + 12 + 4 * i));
+		}
+	}
+	else {
+		fontOffsets.push_back(0);
+	}
+
+	std::vector<PageRange> ranges;
+	for (uint32_t fontOffset : fontOffsets) {
+		if (uint64_t(fontOffset) + 12 > byteSize) continue;
+		int tableCount = ReadU16(data + fontOffset + 4);
+		for (int i = 0; i < tableCount; i++) {
+			uint64_t recordOffset = uint64_t(fontOffset) + 12 + 16 * i;
+			if (recordOffset + 16 > byteSize) break;
+			const uint8_t* record = data + recordOffset;
+			for (const char* tag : kPrefetchedTables) {
+				uint32_t offset = ReadU32(record + 8);
+				if (memcmp(record, tag, 4) == 0 && offset < byteSize) {
+					ranges.push_back(ToPages(offset, ReadU32(record + 12), byteSize));
+				}
+			}
+		}
+	}
+
+	// all reads are requested before waiting for any, so that they overlap
+	for (const PageRange& range : ranges) {
+		madvise(data + range.begin, range.end - range.begin, MADV_WILLNEED);
+	}
+	for (const PageRange& range : ranges) {
+		TouchPages(data, range);
+	}
+}
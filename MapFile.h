@@ -1,17 +1,35 @@
 #pragma once
 #include <cstdint>
 #include <cstddef>
+#include <string>
 
-class MappedFile
+#include "ByteSource.h"
+
+class MappedFile : public ByteSource
 {
 public:
 
+	/// Page faults of the whole process (getrusage()); subtract two readings to see what happened in between.
+	struct PageFaults {
+		uint64_t minor = 0;		///< Served without I/O (the page was in the page cache).
+		uint64_t major = 0;		///< Had to wait for the page to be read.
+
+		static PageFaults Now();
+
+		PageFaults operator-(const PageFaults& other) const
+		{
+			return PageFaults { minor - other.minor, major - other.major };
+		}
+	};
+
 	/**
 	 * Maps the contents of the file to memory.
 	 * On error, the resulting object is invalid, and a terse error description
-	 * is stored using SDL_SetError().
+	 * is stored using SDL_SetError(). Failing to read ahead is not an error.
 	 */
-	MappedFile(const char* fileName);
+	MappedFile(const char* fileName, Access access = Access::kDefault);
+
+	MappedFile(const MappedFile& src) = delete;
 
 	/**
 	 * Calls Unmap().
@@ -23,12 +41,16 @@ public:
 	 */
 	void Unmap();
 
-	bool Ok() const { return (data != nullptr); }
-	uint8_t* GetData() { return data; }
-	const uint8_t* GetData() const { return data; }
-	size_t GetSize() const { return byteSize; }
+	bool IsMapped() const override { return true; }
+
+	/// Bytes of the file currently in memory (whole pages, according to mincore()).
+	size_t GetResidentSize() const override;
+
+	/// Reads the pages of the given part of the file in, waiting until they are there.
+	void Prefetch(size_t offset, size_t length);
 
 protected:
-	uint8_t* data = nullptr;
-	size_t byteSize = 0;
+
+	/// Prefetches the tables a font is rendered from (Access::kFontTables).
+	void PrefetchFontTables();
 };
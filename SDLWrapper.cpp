@@ -109,6 +109,17 @@ Surface::Surface(int width, int height, int depth, uint32_t format)
 
 //---
 
+Surface::Surface(void* pixels, int width, int height, int depth, int pitch, uint32_t format)
+{
+	if (width < 0 || height < 0 || depth < 0 || pitch < 0) {
+		SDL_SetError("surface dimensions must be >= 0");
+		return;
+	}
+	wrapped = SDL_CreateRGBSurfaceWithFormatFrom(pixels, width, height, depth, pitch, format);
+}
+
+//---
+
 Surface::~Surface()
 {
 	Discard();
@@ -150,6 +161,63 @@ Texture::~Texture()
 
 //---
 
+StreamingTexture::StreamingTexture(SDL_Renderer* renderer, uint32_t format_, int width_, int height_)
+	: format(format_), width(width_), height(height_)
+{
+	wrapped = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING, width, height);
+}
+
+//---
+
+StreamingTexture::~StreamingTexture()
+{
+	Unlock();
+}
+
+//---
+
+uint32_t StreamingTexture::GetNativeFormat(SDL_Renderer* renderer)
+{
+	SDL_RendererInfo info;
+	if (SDL_GetRendererInfo(renderer, &info) == 0) {
+		for (uint32_t i = 0; i < info.num_texture_formats; i++) {
+			uint32_t candidate = info.texture_formats[i];
+			if (!SDL_ISPIXELFORMAT_FOURCC(candidate)
+				&& SDL_PIXELLAYOUT(candidate) == SDL_PACKEDLAYOUT_8888
+				&& SDL_ISPIXELFORMAT_ALPHA(candidate)
+			) {
+				return candidate;
+			}
+		}
+	}
+	return SDL_PIXELFORMAT_ARGB8888;
+}
+
+//---
+
+bool StreamingTexture::Lock()
+{
+	if (pixels) return true;
+	if (SDL_LockTexture(wrapped, nullptr, &pixels, &pitch) != 0) {
+		pixels = nullptr;
+		return false;
+	}
+	return true;
+}
+
+//---
+
+void StreamingTexture::Unlock()
+{
+	if (pixels) {
+		SDL_UnlockTexture(wrapped);
+		pixels = nullptr;
+		pitch = 0;
+	}
+}
+
+//---
+
 Renderer::Renderer(SDL_Window* window, int index, uint32_t flags)
 {
 	wrapped = SDL_CreateRenderer(window, index, flags);
@@ -135,6 +135,10 @@ public:
 	/// Constructor, equivalent to SDL_CreateRGBSurfaceWithFormat().
 	Surface(int width, int height, int depth, uint32_t format);
 
+	/// Constructor, equivalent to SDL_CreateRGBSurfaceWithFormatFrom().
+	/// The pixels are not copied; they must outlive the surface.
+	Surface(void* pixels, int width, int height, int depth, int pitch, uint32_t format);
+
 	Surface(const Surface& surface) = delete;
 
 	/// Destructor, calls Discard().
@@ -160,7 +164,64 @@ class Texture : public PtrWrapper<SDL_Texture>
 public:
 
 	Texture(SDL_Renderer* renderer, Surface& src);
+	Texture(const Texture& src) = delete;
 	~Texture();
+
+protected:
+
+	/// For derived classes that create the texture themselves.
+	Texture() {}
+};
+
+//---
+
+/**
+ * Texture created with SDL_TEXTUREACCESS_STREAMING, whose pixels are written
+ * directly: Lock() gives the memory of the texture (or a buffer the renderer
+ * uploads from on Unlock()) in the texture's own format, so nothing is
+ * converted on the way.
+ */
+class StreamingTexture : public Texture
+{
+public:
+
+	/// Constructor, equivalent to SDL_CreateTexture() with SDL_TEXTUREACCESS_STREAMING.
+	StreamingTexture(SDL_Renderer* renderer, uint32_t format_, int width_, int height_);
+
+	/// Destructor, unlocks the texture if it is locked.
+	~StreamingTexture();
+
+	/**
+	 * Returns a format of 32 bits per pixel with 8 bits of alpha that the renderer
+	 * supports natively, in its order of preference (ARGB8888 if it reports none).
+	 */
+	static uint32_t GetNativeFormat(SDL_Renderer* renderer);
+
+	/**
+	 * Locks the whole texture for writing (equivalent to SDL_LockTexture()).
+	 * The pixels are write-only and undefined until written, so all of them
+	 * should be written before Unlock().
+	 */
+	bool Lock();
+
+	/// Unlocks the texture, which uploads the written pixels.
+	void Unlock();
+
+	/// The locked pixels (null unless locked).
+	void* GetPixels() { return pixels; }
+	int GetPitch() const { return pitch; }
+
+	uint32_t GetFormat() const { return format; }
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+
+private:
+
+	uint32_t format;
+	int width;
+	int height;
+	void* pixels = nullptr;
+	int pitch = 0;
 };
 
 //---
@@ -0,0 +1,66 @@
+#include "SdfRender.h"
+#include "LoadFont.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+/// Bilinearly interpolated distance field value; outside the glyph box, the field is 0 (far outside).
+float SampleField(const uint8_t* pixels, int pitch, int width, int height, float u, float v)
+{
+	int x = int(std::floor(u));
+	int y = int(std::floor(v));
+	float fx = u - x;
+	float fy = v - y;
+
+	auto at = [=](int px, int py) -> float {
+		if (px < 0 || py < 0 || px >= width || py >= height) return 0.0f;
+		return pixels[py * pitch + px];
+	};
+	float top = at(x, y) + (at(x + 1, y) - at(x, y)) * fx;
+	float bottom = at(x, y + 1) + (at(x + 1, y + 1) - at(x, y + 1)) * fx;
+	return top + (bottom - top) * fy;
+}
+
+} // namespace
+
+void DrawSdfGlyph(SDL::Surface& atlas, const stbtt_packedchar& glyph, float scale,
+	SDL::Surface& target, float penX, float baselineY, const CoverageBlend& blend)
+{
+	int glyphWidth = glyph.x1 - glyph.x0;
+	int glyphHeight = glyph.y1 - glyph.y0;
+	if (glyphWidth <= 0 || glyphHeight <= 0 || scale <= 0.0f) return;
+
+	const uint8_t* field = static_cast<const uint8_t*>(atlas.GetPixels())
+		+ glyph.y0 * atlas.GetPitch() + glyph.x0;
+
+	// the glyph box in target pixels, clipped to the target
+	float left = penX + glyph.xoff * scale;
+	float top = baselineY + glyph.yoff * scale;
+	int x0 = std::max(0, int(std::floor(left)));
+	int y0 = std::max(0, int(std::floor(top)));
+	int x1 = std::min(target.GetWidth(), int(std::ceil(left + glyphWidth * scale)));
+	int y1 = std::min(target.GetHeight(), int(std::ceil(top + glyphHeight * scale)));
+
+	// a field unit is 1/kSdfPixelDistScale atlas pixels, an atlas pixel is scale target pixels
+	const float targetPixelsPerUnit = scale / Font::kSdfPixelDistScale;
+
+	if (x1 <= x0) return;
+
+	// a row of coverage at a time, blended in one go
+	std::vector<uint8_t> coverage(x1 - x0);
+	uint8_t* targetPixels = static_cast<uint8_t*>(target.GetPixels());
+	for (int y = y0; y < y1; y++) {
+		float v = (y + 0.5f - top) / scale - 0.5f;
+		for (int x = x0; x < x1; x++) {
+			float u = (x + 0.5f - left) / scale - 0.5f;
+			float distance = (SampleField(field, atlas.GetPitch(), glyphWidth, glyphHeight, u, v) - Font::kSdfOnEdge)
+				* targetPixelsPerUnit;
+			coverage[x - x0] = uint8_t(std::clamp(distance + 0.5f, 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+		uint32_t* row = reinterpret_cast<uint32_t*>(targetPixels + y * target.GetPitch());
+		blend.BlendRow(coverage.data(), row + x0, x1 - x0);
+	}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "CoverageBlend.h"
+#include "SDLWrapper.h"
+#include "stb_truetype.h"
+
+/**
+ * Draws a glyph from a signed distance field atlas (Font::AtlasMode::kSdf)
+ * into a 32-bit surface with four 8-bit channels (such as RGBA32, or the locked
+ * pixels of a StreamingTexture in its native format), scaled by the given factor
+ * relative to the size the atlas was made for (target size / Font::GetFontSize()).
+ *
+ * The glyph origin is placed at (penX, baselineY). Coverage is reconstructed
+ * from the interpolated distance with a one-pixel wide ramp at the target
+ * resolution, so edges stay sharp whether the glyph is enlarged or reduced.
+ * The foreground of the blend is blended over the target by the coverage.
+ */
+void DrawSdfGlyph(SDL::Surface& atlas, const stbtt_packedchar& glyph, float scale,
+	SDL::Surface& target, float penX, float baselineY, const CoverageBlend& blend);
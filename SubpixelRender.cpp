@@ -0,0 +1,61 @@
+#include "SubpixelRender.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+/// Division rounding towards negative infinity.
+int FloorDiv(int a, int b)
+{
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+} // namespace
+
+void DrawSubpixelGlyph(SDL::Surface& atlas, const stbtt_packedchar& glyph, int phases,
+	SDL::Surface& target, int32_t penX, int baselineY, const CoverageBlend& blend)
+{
+	int glyphWidth = glyph.x1 - glyph.x0;
+	int glyphHeight = glyph.y1 - glyph.y0;
+	if (glyphWidth <= 0 || glyphHeight <= 0 || phases <= 0) return;
+
+	// stb_truetype shifts xoff by (phases - 1)/2 oversampled pixels to make up for the
+	// delay of its box filter; column i then covers the target pixel whose center is at
+	// pen + xoff + (i + 0.5)/phases, and undoing that shift gives the left edge of the
+	// glyph in oversampled pixels (a whole number)
+	int left = int(std::lround(glyph.xoff * phases + (phases - 1) * 0.5f));
+
+	// the pen in 1/phases pixels, and the column that target column x maps to: x*phases - shift
+	int pen = int(std::lround(penX * phases / 64.0));
+	int shift = pen + left - phases + 1;
+
+	const uint8_t* image = static_cast<const uint8_t*>(atlas.GetPixels())
+		+ glyph.y0 * atlas.GetPitch() + glyph.x0;
+
+	// target columns whose source column lies within the image, clipped to the target
+	int top = baselineY + int(glyph.yoff);
+	int x0 = std::max(0, FloorDiv(shift + phases - 1, phases));
+	int x1 = std::min(target.GetWidth(), FloorDiv(glyphWidth - 1 + shift, phases) + 1);
+	int y0 = std::max(0, top);
+	int y1 = std::min(target.GetHeight(), top + glyphHeight);
+
+	if (x1 <= x0) return;
+
+	// a single phase is blended straight from the atlas, the columns of one of several are gathered first
+	std::vector<uint8_t> gathered((phases > 1) ? x1 - x0 : 0);
+	uint8_t* targetPixels = static_cast<uint8_t*>(target.GetPixels());
+	for (int y = y0; y < y1; y++) {
+		const uint8_t* source = image + (y - top) * atlas.GetPitch();
+		const uint8_t* coverage = source + x0 * phases - shift;
+		if (phases > 1) {
+			for (int x = x0; x < x1; x++) {
+				gathered[x - x0] = source[x * phases - shift];
+			}
+			coverage = gathered.data();
+		}
+		uint32_t* row = reinterpret_cast<uint32_t*>(targetPixels + y * target.GetPitch());
+		blend.BlendRow(coverage, row + x0, x1 - x0);
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+#include "CoverageBlend.h"
+#include "SDLWrapper.h"
+#include "stb_truetype.h"
+
+/**
+ * Draws a glyph from a coverage atlas with the given number of subpixel phases
+ * (Font::GetSubpixelPhases()) into a 32-bit surface with four 8-bit channels,
+ * as DrawSdfGlyph() does.
+ *
+ * The glyph origin is placed at (penX, baselineY), with penX in 1/64 pixels
+ * (26.6 fixed point) rounded to the nearest phase. An oversampled glyph image
+ * holds every phase interleaved: its box-filtered columns are each one target
+ * pixel wide, so every phases-th column starting at the right one is the glyph
+ * at that phase, and drawing it needs no filtering.
+ * With a single phase, this is the glyph at the nearest whole pixel, blended
+ * straight from the atlas rows.
+ * The foreground of the blend is blended over the target by the coverage.
+ */
+void DrawSubpixelGlyph(SDL::Surface& atlas, const stbtt_packedchar& glyph, int phases,
+	SDL::Surface& target, int32_t penX, int baselineY, const CoverageBlend& blend);
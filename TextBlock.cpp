@@ -0,0 +1,302 @@
+#include "TextBlock.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+// character classes of UAX #14, as far as they are told apart here
+
+/// Spaces (SP, and the breaking spaces of BA): lines break after them, and they hang at the end of a line.
+bool IsSpace(uint32_t c)
+{
+	return c == ' ' || c == '\t' || c == 0x1680 || (c >= 0x2000 && c <= 0x200a && c != 0x2007)
+		|| c == 0x205f || c == 0x3000;
+}
+
+/// Hyphens and dashes (HY, BA) and the zero width space (ZW): lines may break after them.
+bool BreaksAfter(uint32_t c)
+{
+	return c == '-' || c == 0x00ad || c == 0x058a || c == 0x2010 || c == 0x2012 || c == 0x2013 || c == 0x200b;
+}
+
+/// Ideographs, kana and hangul (ID, H2, H3): lines may break before and after each of them.
+bool IsIdeograph(uint32_t c)
+{
+	return (c >= 0x2e80 && c <= 0x2fff) || (c >= 0x3040 && c <= 0x9fff) || (c >= 0xac00 && c <= 0xd7a3)
+		|| (c >= 0xf900 && c <= 0xfaff) || (c >= 0x20000 && c <= 0x3fffd);
+}
+
+/// Closing punctuation (CL, CP, EX, IS, NS): never at the start of a line.
+bool NoBreakBefore(uint32_t c)
+{
+	switch (c) {
+		case ')': case ']': case '}': case ',': case '.': case ':': case ';': case '!': case '?':
+		case 0x3001: case 0x3002: case 0x3009: case 0x300b: case 0x300d: case 0x300f: case 0x3011:
+		case 0x30fc: case 0xff01: case 0xff09: case 0xff0c: case 0xff0e: case 0xff1a: case 0xff1b: case 0xff1f:
+			return true;
+	}
+	return false;
+}
+
+/// Opening punctuation (OP): never at the end of a line.
+bool NoBreakAfter(uint32_t c)
+{
+	switch (c) {
+		case '(': case '[': case '{':
+		case 0x3008: case 0x300a: case 0x300c: case 0x300e: case 0x3010: case 0xff08:
+			return true;
+	}
+	return false;
+}
+
+/// Returns true if a line may break between the two characters.
+bool IsBreakOpportunity(uint32_t before, uint32_t after)
+{
+	if (IsSpace(after) || NoBreakBefore(after) || NoBreakAfter(before)) return false;
+	if (IsSpace(before)) return true;
+
+	// a hyphen before a digit is a minus sign
+	if (BreaksAfter(before)) return !(before == '-' && after >= '0' && after <= '9');
+	return IsIdeograph(before) || IsIdeograph(after);
+}
+
+/// Length in bytes of the explicit line break at p (0 if there is none); the text is valid UTF-8.
+size_t LineBreakLength(const char* p, const char* end)
+{
+	uint8_t c = uint8_t(p[0]);
+	if (c == '\n') return 1;
+	if (c == '\r') return (p + 1 < end && p[1] == '\n') ? 2 : 1;
+	if (c == 0xc2 && uint8_t(p[1]) == 0x85) return 2;
+	if (c == 0xe2 && uint8_t(p[1]) == 0x80 && (uint8_t(p[2]) == 0xa8 || uint8_t(p[2]) == 0xa9)) return 3;
+	return 0;
+}
+
+/// Splits the text at explicit line breaks; a break at the very end starts an empty last paragraph.
+std::vector<std::string_view> SplitParagraphs(const Utf8Text& text)
+{
+	std::vector<std::string_view> result;
+	const char* start = text.GetData();
+	const char* end = start + text.GetLength();
+	const char* p = start;
+	while (p < end) {
+		size_t breakLength = LineBreakLength(p, end);
+		if (breakLength) {
+			result.emplace_back(start, p - start);
+			p += breakLength;
+			start = p;
+		}
+		else {
+			p++;
+		}
+	}
+	result.emplace_back(start, end - start);
+	return result;
+}
+
+} // namespace
+
+TextBlock::TextBlock(const Font& font_, float scale_, int sizeIndex_, LayoutCache* layoutCache_)
+	: font(font_), layoutCache(layoutCache_), scale(scale_), sizeIndex(sizeIndex_), atlasVersion(font_.GetAtlasVersion())
+{
+	lineHeight = int(std::lround(font.GetFontSize(sizeIndex) * scale * kLineSpacing));
+}
+
+void TextBlock::SetText(const Utf8Text& text)
+{
+	// paragraphs whose text is still there keep their layout and lines, wherever they are now
+	std::vector<Paragraph> previous;
+	previous.swap(paragraphs);
+	std::unordered_multimap<std::string_view, int> previousByText;
+	previousByText.reserve(previous.size());
+	for (size_t i = 0; i < previous.size(); i++) {
+		previousByText.emplace(previous[i].text, int(i));
+	}
+
+	std::vector<std::string_view> texts = SplitParagraphs(text);
+	paragraphs.resize(texts.size());
+	for (size_t i = 0; i < texts.size(); i++) {
+		auto found = previousByText.find(texts[i]);
+		if (found != previousByText.end()) {
+			int from = found->second;
+			previousByText.erase(found);
+			paragraphs[i] = std::move(previous[from]);
+		}
+		else {
+			paragraphs[i].text.assign(texts[i]);
+		}
+	}
+	linesDirty = true;
+}
+
+void TextBlock::SetParagraph(int index, const Utf8Text& text)
+{
+	Paragraph& paragraph = paragraphs[index];
+	std::string_view newText(text.GetData(), text.GetLength());
+	if (paragraph.text == newText) return;
+
+	paragraph.text.assign(newText);
+	paragraph.laidOut = false;
+	linesDirty = true;
+}
+
+void TextBlock::SetWidth(int width_)
+{
+	width = std::max(width_, 0);
+}
+
+void TextBlock::Layout(Paragraph& paragraph)
+{
+	Utf8Text text(paragraph.text.data(), paragraph.text.size());
+	if (layoutCache && text.GetLength() <= kCachedParagraphLength) {
+		paragraph.run = layoutCache->Get(font, text, scale, sizeIndex);
+	}
+	else {
+		paragraph.run = LayoutText(font, text, scale, sizeIndex);
+	}
+	paragraph.breaks.clear();
+
+	const std::vector<PositionedGlyph>& glyphs = paragraph.run.glyphs;
+	int glyphCount = int(glyphs.size());
+	auto contentEnd = [&glyphs](int end) {
+		while (end > 0 && IsSpace(uint32_t(glyphs[end - 1].codepoint))) end--;
+		return end;
+	};
+	for (int i = 1; i < glyphCount; i++) {
+		if (IsBreakOpportunity(uint32_t(glyphs[i - 1].codepoint), uint32_t(glyphs[i].codepoint))) {
+			paragraph.breaks.push_back(Break { i, contentEnd(i) });
+		}
+	}
+	paragraph.breaks.push_back(Break { glyphCount, contentEnd(glyphCount) });
+
+	paragraph.laidOut = true;
+	paragraph.wrapWidth = -1;
+	stats.paragraphLayouts++;
+}
+
+void TextBlock::Wrap(Paragraph& paragraph, int index)
+{
+	const GlyphRun& run = paragraph.run;
+	const int glyphCount = int(run.glyphs.size());
+	auto penAt = [&run, glyphCount](int glyph) {
+		return (glyph < glyphCount) ? run.glyphs[glyph].x : run.advance;
+	};
+	const int64_t limit = (width > 0) ? int64_t(width) * 64 : INT64_MAX;
+
+	paragraph.lines.clear();
+	int start = 0;
+	size_t next = 0;
+	do {
+		const int64_t startX = penAt(start);
+		while (next + 1 < paragraph.breaks.size() && paragraph.breaks[next].glyph <= start) {
+			next++;
+		}
+
+		// the furthest break whose line still fits
+		Break end = paragraph.breaks[next];
+		if (penAt(end.contentEnd) - startX <= limit) {
+			while (next + 1 < paragraph.breaks.size()
+				&& penAt(paragraph.breaks[next + 1].contentEnd) - startX <= limit
+			) {
+				next++;
+			}
+			end = paragraph.breaks[next];
+		}
+		else {
+			// not even the first word fits, so it is broken where the width runs out (after one glyph at least)
+			int glyph = start + 1;
+			while (glyph < end.contentEnd && penAt(glyph + 1) - startX <= limit) {
+				glyph++;
+			}
+			if (glyph < end.contentEnd) {
+				end = Break { glyph, glyph };
+			}
+		}
+
+		WrappedLine line;
+		line.paragraph = index;
+		line.firstGlyph = start;
+		line.glyphCount = std::max(end.contentEnd - start, 0);
+		line.startX = startX;
+		line.width = std::max(penAt(end.contentEnd) - startX, int64_t(0));
+		line.bounds = GetInkBounds(run, start, line.glyphCount, startX);
+		paragraph.lines.push_back(line);
+		start = end.glyph;
+	} while (start < glyphCount);
+
+	paragraph.wrapWidth = width;
+	stats.paragraphWraps++;
+}
+
+bool TextBlock::IsWrapCurrent(const Paragraph& paragraph) const
+{
+	if (paragraph.wrapWidth < 0) return false;
+	if (paragraph.wrapWidth == width) return true;
+
+	// a paragraph that was not wrapped needs not be wrapped as long as it fits
+	return paragraph.lines.size() == 1 && (width == 0 || paragraph.lines[0].width <= int64_t(width) * 64);
+}
+
+const std::vector<WrappedLine>& TextBlock::GetLines()
+{
+	// a grown atlas moves the glyphs, so the geometry in all runs is stale
+	if (font.GetAtlasVersion() != atlasVersion) {
+		atlasVersion = font.GetAtlasVersion();
+		for (Paragraph& paragraph : paragraphs) {
+			paragraph.laidOut = false;
+		}
+		linesDirty = true;
+	}
+
+	for (size_t i = 0; i < paragraphs.size(); i++) {
+		Paragraph& paragraph = paragraphs[i];
+		if (!paragraph.laidOut) {
+			Layout(paragraph);
+		}
+		if (!IsWrapCurrent(paragraph)) {
+			Wrap(paragraph, int(i));
+			linesDirty = true;
+		}
+	}
+	if (!linesDirty) return lines;
+
+	lines.clear();
+	bool empty = true;
+	int top = 0, bottom = 0, left = 0, right = 0;
+	for (size_t i = 0; i < paragraphs.size(); i++) {
+		for (WrappedLine line : paragraphs[i].lines) {
+			line.paragraph = int(i);
+			line.baselineY = int(lines.size()) * lineHeight;
+			if (line.bounds.w > 0 && line.bounds.h > 0) {
+				int lineTop = line.baselineY + line.bounds.y;
+				int lineBottom = lineTop + line.bounds.h;
+				if (empty) {
+					left = line.bounds.x;
+					top = lineTop;
+					right = line.bounds.x + line.bounds.w;
+					bottom = lineBottom;
+					empty = false;
+				}
+				else {
+					left = std::min(left, line.bounds.x);
+					top = std::min(top, lineTop);
+					right = std::max(right, line.bounds.x + line.bounds.w);
+					bottom = std::max(bottom, lineBottom);
+				}
+			}
+			lines.push_back(line);
+		}
+	}
+	bounds = SDL_Rect { left, top, right - left, bottom - top };
+	linesDirty = false;
+	return lines;
+}
+
+SDL_Rect TextBlock::GetBounds()
+{
+	GetLines();
+	return bounds;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "LayoutCache.h"
+#include "TextLayout.h"
+#include "ToUnicode.h"
+
+/// A line of a text block: a slice of the glyph run of one of its paragraphs.
+struct WrappedLine {
+	int paragraph;
+	int firstGlyph;		///< Index into the paragraph's run.
+	int glyphCount;
+	int64_t startX;		///< Pen position (26.6) of the first glyph in the run; subtract it to start the line at 0.
+	int64_t width;		///< Advance of the line without its trailing spaces (26.6).
+	int baselineY = 0;	///< Baseline relative to the baseline of the first line of the block.
+
+	/// Box covered by the glyph images, relative to the start of the line on its baseline.
+	SDL_Rect bounds = { 0, 0, 0, 0 };
+};
+
+/**
+ * Text of any number of lines: split into paragraphs at explicit line breaks
+ * (LF, CR, CRLF, NEL, U+2028 and U+2029), each laid out once and wrapped greedily
+ * to the width at break opportunities (a subset of UAX #14: after spaces and
+ * hyphens, after zero width spaces and around ideographs). A word longer than
+ * the width is broken between any two glyphs.
+ *
+ * Break positions and their widths are kept per paragraph, so a new width only
+ * re-wraps the paragraphs that do not fit it (without looking up a single glyph),
+ * and a changed paragraph is laid out again on its own. Setting text reuses
+ * the layouts of the paragraphs whose text is unchanged, wherever they have moved.
+ *
+ * With a layout cache, paragraphs up to kCachedParagraphLength bytes are looked up
+ * there before they are laid out, so a text that repeats lines (a log) lays each out once.
+ *
+ * The font (and the cache) must outlive the block; if its atlas changes (a lazy font
+ * that grows), everything is laid out again.
+ */
+class TextBlock
+{
+public:
+
+	/// Spacing of baselines relative to the font size (which stb sizes as ascent to descent).
+	static constexpr float kLineSpacing = 1.2f;
+
+	/// How much work the block has done, for benchmarks.
+	struct Stats {
+		uint64_t paragraphLayouts = 0;	///< Paragraphs laid out (glyph lookup, kerning, break search).
+		uint64_t paragraphWraps = 0;	///< Paragraphs split into lines.
+	};
+
+	/// Longest paragraph taken from the layout cache, in bytes; longer ones seldom repeat and would crowd out the rest.
+	static const size_t kCachedParagraphLength = 1024;
+
+	/// The text is laid out as LayoutText() would, with the given scale and size of the font.
+	TextBlock(const Font& font_, float scale_ = 1.0f, int sizeIndex_ = 0, LayoutCache* layoutCache_ = nullptr);
+
+	TextBlock(const TextBlock& src) = delete;
+
+	/// Replaces the whole text.
+	void SetText(const Utf8Text& text);
+
+	/// Replaces the text of one paragraph (which must not contain line breaks).
+	void SetParagraph(int index, const Utf8Text& text);
+
+	/// Sets the width to wrap to, in pixels (0 or less: no wrapping).
+	void SetWidth(int width_);
+
+	int GetParagraphCount() const { return int(paragraphs.size()); }
+
+	/// Returns the lines, wrapping or laying out what has changed first.
+	const std::vector<WrappedLine>& GetLines();
+
+	/// The run a line's glyphs come from.
+	const GlyphRun& GetRun(const WrappedLine& line) const { return paragraphs[line.paragraph].run; }
+
+	/// Box covered by the glyph images of all lines (as GetLines() returns them, each starting at 0),
+	/// relative to the baseline of the first line.
+	SDL_Rect GetBounds();
+
+	/// Distance of baselines in pixels.
+	int GetLineHeight() const { return lineHeight; }
+
+	Stats GetStats() const { return stats; }
+
+private:
+
+	/// A place where a line may start, and where the line before it would end.
+	struct Break {
+		int glyph;			///< First glyph of the next line.
+		int contentEnd;		///< End of the glyphs of the previous line without its trailing spaces.
+	};
+
+	struct Paragraph {
+		std::string text;				///< UTF-8.
+		GlyphRun run;
+		std::vector<Break> breaks;		///< In order; the end of the paragraph is the last one.
+		bool laidOut = false;
+		int wrapWidth = -1;				///< The width the lines were made for (-1 if not wrapped yet).
+		std::vector<WrappedLine> lines;
+	};
+
+	/// Lays out the paragraph and finds its break opportunities.
+	void Layout(Paragraph& paragraph);
+
+	/// Splits the laid out paragraph into lines of the current width.
+	void Wrap(Paragraph& paragraph, int index);
+
+	/// True if the lines of the paragraph are still right for the current width.
+	bool IsWrapCurrent(const Paragraph& paragraph) const;
+
+	const Font& font;
+	LayoutCache* layoutCache;
+	float scale;
+	int sizeIndex;
+	int lineHeight;
+	int atlasVersion;
+	int width = 0;
+	Stats stats;
+
+	std::vector<Paragraph> paragraphs;
+
+	/// Lines of all paragraphs, valid unless linesDirty.
+	std::vector<WrappedLine> lines;
+	SDL_Rect bounds = { 0, 0, 0, 0 };
+	bool linesDirty = true;
+};
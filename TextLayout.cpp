@@ -0,0 +1,100 @@
+#include "TextLayout.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/// Lays out any sequence of codepoints; maxGlyphCount bounds the number of glyphs.
+template<class Text>
+GlyphRun LayoutCodepoints(const Font& font, const Text& text, size_t maxGlyphCount, float scale, int sizeIndex)
+{
+	GlyphRun run;
+	run.scale = scale;
+	run.sizeIndex = sizeIndex;
+	run.glyphs.reserve(maxGlyphCount);
+
+	// the kerning table is for one size of the font, which need not be this one
+	float kerningScale = scale * font.GetKerningScale(sizeIndex);
+
+	// advances are summed unrounded and only the pen is rounded, so that rounding
+	// errors do not add up along the line (kerning is in 1/64 pixels already)
+	double advances = 0.0;
+	int64_t kerning = 0;
+	uint32_t previous = 0;
+	for (uint32_t c : text) {
+		PositionedGlyph glyph;
+		if (!font.GetGlyphGeometry(int(c), glyph.geometry, sizeIndex)) {
+			previous = 0;
+			continue;
+		}
+		if (previous) {
+			int32_t pairKerning = font.GetKerningTable().Get(previous, c);
+			kerning += (kerningScale == 1.0f) ? pairKerning : int32_t(std::lround(pairKerning * kerningScale));
+		}
+		previous = c;
+
+		glyph.codepoint = int(c);
+		glyph.x = PixelsToPen(advances) + kerning;
+		advances += glyph.geometry.xadvance * scale;
+
+		run.glyphs.push_back(glyph);
+	}
+
+	run.advance = PixelsToPen(advances) + kerning;
+	run.bounds = GetInkBounds(run, 0, int(run.glyphs.size()), 0);
+	return run;
+}
+
+} // namespace
+
+SDL_Rect GetInkBounds(const GlyphRun& run, int first, int count, int64_t startX)
+{
+	bool empty = true;
+	double left = 0.0, top = 0.0, right = 0.0, bottom = 0.0;
+	for (int i = first; i < first + count; i++) {
+		const PositionedGlyph& glyph = run.glyphs[i];
+
+		// glyphs without an image (spaces) do not extend the box; it comes from xoff2/yoff2
+		// rather than the image size, which is larger for oversampled glyphs
+		const stbtt_packedchar& g = glyph.geometry;
+		if (g.x1 <= g.x0 || g.y1 <= g.y0) continue;
+
+		double x = PenToPixels(glyph.x - startX);
+		double glyphLeft = x + g.xoff * run.scale;
+		double glyphTop = g.yoff * run.scale;
+		double glyphRight = x + g.xoff2 * run.scale;
+		double glyphBottom = g.yoff2 * run.scale;
+		if (empty) {
+			left = glyphLeft;
+			top = glyphTop;
+			right = glyphRight;
+			bottom = glyphBottom;
+			empty = false;
+		}
+		else {
+			left = std::min(left, glyphLeft);
+			top = std::min(top, glyphTop);
+			right = std::max(right, glyphRight);
+			bottom = std::max(bottom, glyphBottom);
+		}
+	}
+
+	SDL_Rect result;
+	result.x = int(std::floor(left));
+	result.y = int(std::floor(top));
+	result.w = int(std::ceil(right)) - result.x;
+	result.h = int(std::ceil(bottom)) - result.y;
+	return result;
+}
+
+GlyphRun LayoutText(const Font& font, const std::wstring& text, float scale, int sizeIndex)
+{
+	return LayoutCodepoints(font, text, text.size(), scale, sizeIndex);
+}
+
+GlyphRun LayoutText(const Font& font, const Utf8Text& text, float scale, int sizeIndex)
+{
+	// there are at most as many glyphs as bytes
+	return LayoutCodepoints(font, text, text.GetLength(), scale, sizeIndex);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "LoadFont.h"
+#include "ToUnicode.h"
+
+/// Pen positions are kept in 26.6 fixed point (1/64 pixels, the unit of kerning), fine enough
+/// to pick subpixel phases from and never truncated to whole pixels before drawing.
+inline int32_t PixelsToPen(float pixels) { return int32_t(std::lround(pixels * 64.0f)); }
+inline float PenToPixels(int32_t pen) { return pen / 64.0f; }
+
+/// Positions along a whole run, which may be a paragraph of megabytes: a float keeps 1/64 pixels
+/// only up to 2^17 pixels, and 26.6 in 32 bits overflows at 2^25.
+inline int64_t PixelsToPen(double pixels) { return std::llround(pixels * 64.0); }
+inline double PenToPixels(int64_t pen) { return pen / 64.0; }
+
+/// The whole pixel nearest to the pen position.
+inline int PenToNearestPixel(int32_t pen) { return (pen + 32) >> 6; }
+
+/// A glyph placed on a line of text.
+struct PositionedGlyph {
+	int codepoint;
+	int64_t x;						///< Pen position of the glyph origin (26.6), relative to the start of the line.
+	stbtt_packedchar geometry;		///< As returned by Font::GetGlyphGeometry() (unscaled).
+};
+
+/// A laid out line of text.
+struct GlyphRun {
+	std::vector<PositionedGlyph> glyphs;
+	float scale = 1.0f;		///< Target size relative to the size of the atlas (1 unless it is a distance field atlas).
+	int sizeIndex = 0;		///< Which of the font's sizes the glyphs are of.
+	int64_t advance = 0;	///< Pen position after the last glyph (26.6).
+
+	/// Box covered by the glyph images, relative to the start of the line on the baseline.
+	SDL_Rect bounds = { 0, 0, 0, 0 };
+};
+
+/**
+ * Places the glyphs of the text on a single line, applying kerning.
+ * Characters the font has no glyph for are skipped.
+ * Positions and bounds are scaled by the given factor (for distance field atlases).
+ * The glyphs are of the given size of the font; runs of different sizes can be drawn
+ * from the same atlas.
+ */
+GlyphRun LayoutText(const Font& font, const std::wstring& text, float scale = 1.0f, int sizeIndex = 0);
+
+/// Like the above, decoding the UTF-8 text as it goes (without widening it into a string first).
+GlyphRun LayoutText(const Font& font, const Utf8Text& text, float scale = 1.0f, int sizeIndex = 0);
+
+/**
+ * Box covered by the images of glyphs [first, first + count) of the run, relative to
+ * startX on the baseline (the bounds of a run are this box of all its glyphs).
+ * Glyphs without an image, such as spaces, do not extend it; it is empty at (0, 0) if none has one.
+ */
+SDL_Rect GetInkBounds(const GlyphRun& run, int first, int count, int64_t startX);
@@ -1,30 +1,330 @@
 #include "ToUnicode.h"
 #include "SDL.h"
-#include <iostream>
-#include <cwchar>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
 
-std::wstring MultibyteToWideString(const char* source)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOUNICODE_X86 1
+#endif
+
+// codepoints are written straight into the string
+static_assert(sizeof(wchar_t) == 4, "wchar_t must hold any codepoint");
+
+namespace {
+
+/// Widens the ASCII prefix of the bytes into codepoints, in whole blocks;
+/// returns the number of bytes done (the rest is left to the scalar decoder).
+using WidenAsciiFunction = size_t (*)(const uint8_t* source, size_t length, wchar_t* dest);
+
+/// Portable variant, 8 bytes at a time.
+size_t WidenAsciiScalar(const uint8_t* source, size_t length, wchar_t* dest)
+{
+	size_t i = 0;
+	for (; i + 8 <= length; i += 8) {
+		uint64_t block;
+		memcpy(&block, source + i, 8);
+		if (block & 0x8080808080808080ull) break;
+		for (size_t j = 0; j < 8; j++) {
+			dest[i + j] = wchar_t(source[i + j]);
+		}
+	}
+	return i;
+}
+
+#ifdef TOUNICODE_X86
+
+__attribute__((target("sse2")))
+size_t WidenAsciiSse2(const uint8_t* source, size_t length, wchar_t* dest)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+		if (_mm_movemask_epi8(bytes)) break;
+		__m128i low = _mm_unpacklo_epi8(bytes, zero);
+		__m128i high = _mm_unpackhi_epi8(bytes, zero);
+		__m128i* out = reinterpret_cast<__m128i*>(dest + i);
+		_mm_storeu_si128(out, _mm_unpacklo_epi16(low, zero));
+		_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(low, zero));
+		_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(high, zero));
+		_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(high, zero));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+size_t WidenAsciiAvx2(const uint8_t* source, size_t length, wchar_t* dest)
+{
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32) {
+		__m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+		if (_mm256_movemask_epi8(bytes)) break;
+		__m256i* out = reinterpret_cast<__m256i*>(dest + i);
+		for (int j = 0; j < 4; j++) {
+			__m128i eight = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + i + 8 * j));
+			_mm256_storeu_si256(out + j, _mm256_cvtepu8_epi32(eight));
+		}
+	}
+
+	// a non-ASCII byte in the second half of a block still leaves a half to do
+	// (with VEX encoded instructions, as mixing in the SSE2 variant would stall on the state transition)
+	if (i + 16 <= length) {
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+		if (!_mm_movemask_epi8(bytes)) {
+			__m256i* out = reinterpret_cast<__m256i*>(dest + i);
+			_mm256_storeu_si256(out, _mm256_cvtepu8_epi32(bytes));
+			_mm256_storeu_si256(out + 1, _mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+			i += 16;
+		}
+	}
+
+	// GCC does not clear the upper halves itself in a function of another target
+	_mm256_zeroupper();
+	return i;
+}
+
+#endif
+
+WidenAsciiFunction SelectWidenAscii()
+{
+#ifdef TOUNICODE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return WidenAsciiAvx2;
+#ifdef __SSE2__
+	return WidenAsciiSse2;
+#else
+	if (__builtin_cpu_supports("sse2")) return WidenAsciiSse2;
+#endif
+#endif
+	return WidenAsciiScalar;
+}
+
+/// Shortest input for which trying the block kernels is worth the call.
+const size_t kMinAsciiBlock = 16;
+
+/// What the lead byte of a multibyte sequence says about the sequence.
+struct SequenceStart {
+	size_t size = 0;		///< Bytes in the sequence (0 if the byte cannot start one).
+	uint32_t bits = 0;		///< Codepoint bits carried by the lead byte.
+
+	// the ranges of the second byte exclude overlong forms, surrogates and codepoints above U+10FFFF
+	uint8_t secondMin = 0x80;
+	uint8_t secondMax = 0xbf;
+};
+
+SequenceStart ReadLead(uint8_t lead)
 {
+	SequenceStart start;
+	if (lead >= 0xc2 && lead <= 0xdf) {
+		start.size = 2;
+		start.bits = lead & 0x1f;
+	}
+	else if (lead >= 0xe0 && lead <= 0xef) {
+		start.size = 3;
+		start.bits = lead & 0x0f;
+		if (lead == 0xe0) start.secondMin = 0xa0;
+		if (lead == 0xed) start.secondMax = 0x9f;
+	}
+	else if (lead >= 0xf0 && lead <= 0xf4) {
+		start.size = 4;
+		start.bits = lead & 0x07;
+		if (lead == 0xf0) start.secondMin = 0x90;
+		if (lead == 0xf4) start.secondMax = 0x8f;
+	}
+	return start;
+}
+
+/// Returns the number of bytes of the sequence at bytes that are valid, up to its size
+/// (so, at the end of the input, the sequence can be told apart from an invalid one).
+size_t CheckSequence(const uint8_t* bytes, size_t length, const SequenceStart& start)
+{
+	size_t end = std::min(length, start.size);
+	if (end < 2) return end;
+	if (bytes[1] < start.secondMin || bytes[1] > start.secondMax) return 1;
+	for (size_t j = 2; j < end; j++) {
+		if ((bytes[j] & 0xc0) != 0x80) return j;
+	}
+	return end;
+}
+
+/**
+ * Decodes up to the first sequence that is invalid or cut off by the end of the input;
+ * returns the offset it stopped at and adds the number of codepoints written to count.
+ * dest needs room for length codepoints.
+ */
+size_t DecodeComplete(const uint8_t* bytes, size_t length, wchar_t* dest, size_t& count)
+{
+	static const WidenAsciiFunction widenAscii = SelectWidenAscii();
+
+	size_t i = 0;
+	while (i < length) {
+		uint8_t lead = bytes[i];
+		if (lead < 0x80) {
+			if (length - i >= kMinAsciiBlock) {
+				size_t done = widenAscii(bytes + i, length - i, dest + count);
+				i += done;
+				count += done;
+				if (done) continue;
+			}
+			dest[count++] = wchar_t(lead);
+			i++;
+			continue;
+		}
+
+		SequenceStart start = ReadLead(lead);
+		if (!start.size || CheckSequence(bytes + i, length - i, start) < start.size) break;
+
+		uint32_t codepoint = start.bits;
+		for (size_t j = 1; j < start.size; j++) {
+			codepoint = (codepoint << 6) | (bytes[i + j] & 0x3f);
+		}
+		dest[count++] = wchar_t(codepoint);
+		i += start.size;
+	}
+	return i;
+}
+
+} // namespace
+
+size_t DecodeUtf8(const char* source, size_t length, std::wstring& result)
+{
+	// never more characters than bytes; the string is cut to size at the end
+	result.resize(length);
+	size_t count = 0;
+	size_t end = DecodeComplete(reinterpret_cast<const uint8_t*>(source), length, &result[0], count);
+	result.resize(count);
+	return (end < length) ? end : kUtf8Valid;
+}
+
+size_t ValidateUtf8(const char* source, size_t length)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(source);
+	size_t i = 0;
+	while (i < length) {
+		if (bytes[i] < 0x80) {
+			// skip ASCII a block at a time
+#ifdef __SSE2__
+			while (length - i >= 16
+				&& !_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i)))
+			) {
+				i += 16;
+			}
+#else
+			for (; length - i >= 8; i += 8) {
+				uint64_t block;
+				memcpy(&block, bytes + i, 8);
+				if (block & 0x8080808080808080ull) break;
+			}
+#endif
+			if (i < length && bytes[i] < 0x80) i++;
+			continue;
+		}
+
+		SequenceStart start = ReadLead(bytes[i]);
+		if (!start.size || CheckSequence(bytes + i, length - i, start) < start.size) return i;
+		i += start.size;
+	}
+	return kUtf8Valid;
+}
+
+//---
+
+std::wstring Utf8Text::GetCharacterSet() const
+{
+	// one bit per codepoint, collected in order
+	std::vector<uint64_t> seen((0x110000 + 63) / 64);
+	for (uint32_t c : *this) {
+		seen[c / 64] |= uint64_t(1) << (c % 64);
+	}
+
 	std::wstring result;
+	for (size_t word = 0; word < seen.size(); word++) {
+		for (uint64_t bits = seen[word]; bits; bits &= bits - 1) {
+			result += wchar_t(word * 64 + __builtin_ctzll(bits));
+		}
+	}
+	return result;
+}
 
-	const char* p = source;
-	size_t messageCharCount = 0;
+//---
 
-	// calculate the number of wide characters needed (also checks encoding validity)
-	{
-		auto mbstate = std::mbstate_t();
-		messageCharCount = std::mbsrtowcs(nullptr, &p, 0, &mbstate);
-		if (messageCharCount == size_t(-1)) {
-			SDL_SetError("Invalid character sequence");
-			return result;
+void Utf8Decoder::Reset()
+{
+	pendingCount = 0;
+	byteCount = 0;
+	errorOffset = kUtf8Valid;
+}
+
+size_t Utf8Decoder::Decode(const char* chunk, size_t length, wchar_t* dest)
+{
+	if (errorOffset != kUtf8Valid) return 0;
+
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(chunk);
+	size_t count = 0;
+
+	// first complete the sequence the previous chunk ended in
+	size_t used = 0;
+	if (pendingCount) {
+		SequenceStart start = ReadLead(pending[0]);
+		used = std::min(start.size - pendingCount, length);
+		memcpy(pending + pendingCount, bytes, used);
+		size_t available = pendingCount + used;
+		size_t valid = CheckSequence(pending, available, start);
+		if (valid < available) {
+			errorOffset = byteCount - pendingCount;
+			return 0;
+		}
+		byteCount += used;
+		if (available < start.size) {
+			pendingCount = available;
+			return 0;
 		}
-	}	
+		DecodeComplete(pending, available, dest, count);
+		pendingCount = 0;
+	}
+
+	size_t end = used + DecodeComplete(bytes + used, length - used, dest, count);
+	if (end < length) {
+		// a sequence cut off by the end of the chunk waits for the next one
+		SequenceStart start = ReadLead(bytes[end]);
+		size_t rest = length - end;
+		if (start.size > rest && CheckSequence(bytes + end, rest, start) == rest) {
+			memcpy(pending, bytes + end, rest);
+			pendingCount = rest;
+		}
+		else {
+			errorOffset = byteCount + (end - used);
+		}
+	}
+	byteCount += length - used;
+	return count;
+}
 
-	result.resize(messageCharCount);
-	{
-		auto mbstate = std::mbstate_t();
-		p = source;
-		std::mbsrtowcs(const_cast<wchar_t*>(result.data()), &p, messageCharCount, &mbstate);
+bool Utf8Decoder::Finish()
+{
+	if (pendingCount && errorOffset == kUtf8Valid) {
+		errorOffset = byteCount - pendingCount;
+	}
+	pendingCount = 0;
+	return errorOffset == kUtf8Valid;
+}
+
+//---
+
+std::wstring MultibyteToWideString(const char* source)
+{
+	return MultibyteToWideString(source, strlen(source));
+}
+
+std::wstring MultibyteToWideString(const char* source, size_t length)
+{
+	std::wstring result;
+	size_t errorOffset = DecodeUtf8(source, length, result);
+	if (errorOffset != kUtf8Valid) {
+		SDL_SetError("Invalid UTF-8 sequence at byte %zu", errorOffset);
+		return std::wstring();
 	}
 	return result;
 }
@@ -1,13 +1,158 @@
 #pragma once
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
 #include <vector>
 #include <string>
 
+/// Returned by DecodeUtf8() when the whole input is valid.
+const size_t kUtf8Valid = size_t(-1);
+
+/**
+ * Decodes UTF-8 into Unicode codepoints in a single pass, whatever the locale.
+ * Overlong forms, surrogates, codepoints above U+10FFFF and sequences cut off
+ * by the end of the input are invalid; null characters are decoded like any other.
+ * Runs of ASCII are checked and widened 16 or 32 bytes at a time
+ * (with SSE2, or AVX2 where the CPU has it).
+ * \return kUtf8Valid, or the byte offset of the first invalid sequence
+ * (result then holds the characters before it).
+ */
+size_t DecodeUtf8(const char* source, size_t length, std::wstring& result);
+
+/// Like DecodeUtf8(), but only checks the text (without decoding it anywhere).
+size_t ValidateUtf8(const char* source, size_t length);
+
+/**
+ * Valid UTF-8 text, seen as a sequence of codepoints that are decoded
+ * as they are iterated over; the bytes are neither copied nor widened.
+ * The view does not own them, so they must outlive it.
+ */
+class Utf8Text
+{
+public:
+
+	/// Forward iterator over the codepoints.
+	class Iterator
+	{
+	public:
+
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = uint32_t;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const uint32_t*;
+		using reference = uint32_t;
+
+		Iterator() = default;
+		explicit Iterator(const uint8_t* p_) : p(p_) {}
+
+		uint32_t operator*() const
+		{
+			uint8_t lead = p[0];
+			if (lead < 0x80) return lead;
+			if (lead < 0xe0) return ((lead & 0x1fu) << 6) | (p[1] & 0x3fu);
+			if (lead < 0xf0) return ((lead & 0x0fu) << 12) | ((p[1] & 0x3fu) << 6) | (p[2] & 0x3fu);
+			return ((lead & 0x07u) << 18) | ((p[1] & 0x3fu) << 12) | ((p[2] & 0x3fu) << 6) | (p[3] & 0x3fu);
+		}
+
+		Iterator& operator++()
+		{
+			uint8_t lead = p[0];
+			p += (lead < 0x80) ? 1 : (lead < 0xe0) ? 2 : (lead < 0xf0) ? 3 : 4;
+			return *this;
+		}
+
+		Iterator operator++(int) { Iterator old = *this; ++*this; return old; }
+
+		bool operator==(const Iterator& other) const { return p == other.p; }
+		bool operator!=(const Iterator& other) const { return p != other.p; }
+
+	private:
+
+		const uint8_t* p = nullptr;
+	};
+
+	Utf8Text() = default;
+
+	/// The bytes must be valid UTF-8 (check them with ValidateUtf8() first if they may not be).
+	Utf8Text(const char* data_, size_t length_) : data(data_), length(length_) {}
+
+	Iterator begin() const { return Iterator(reinterpret_cast<const uint8_t*>(data)); }
+	Iterator end() const { return Iterator(reinterpret_cast<const uint8_t*>(data) + length); }
+
+	const char* GetData() const { return data; }
+
+	/// Length in bytes (an upper bound of the number of codepoints).
+	size_t GetLength() const { return length; }
+
+	bool IsEmpty() const { return length == 0; }
+
+	/// Returns the distinct codepoints of the text, in ascending order.
+	std::wstring GetCharacterSet() const;
+
+private:
+
+	const char* data = nullptr;
+	size_t length = 0;
+};
+
 /**
- * Converts a string from multibyte encoding to wide string
- * (under normal conditions, it is from utf-8 to Unicode).
+ * Decodes UTF-8 that arrives in chunks of any size (as read() returns them),
+ * with the same validation as DecodeUtf8(). A sequence split between chunks
+ * is kept until the next chunk completes it.
+ */
+class Utf8Decoder
+{
+public:
+
+	/// Room Decode() needs at dest for a chunk of the given size
+	/// (a completed sequence is at most one codepoint more, but takes at least one byte of the chunk).
+	static size_t GetMaxCodepoints(size_t chunkLength) { return chunkLength; }
+
+	/**
+	 * Decodes the next chunk, writing the codepoints at dest, which needs room for
+	 * GetMaxCodepoints(length) of them; nothing is allocated.
+	 * After an invalid sequence, nothing more is decoded (until Reset()).
+	 * \return The number of codepoints written.
+	 */
+	size_t Decode(const char* chunk, size_t length, wchar_t* dest);
+
+	/// Ends the stream; a sequence it ends in the middle of is invalid.
+	/// \return True if the whole stream was valid.
+	bool Finish();
+
+	/// Forgets the stream, to start another.
+	void Reset();
+
+	bool Ok() const { return errorOffset == kUtf8Valid; }
+
+	/// Offset of the first invalid sequence from the start of the stream (kUtf8Valid if there is none).
+	size_t GetErrorOffset() const { return errorOffset; }
+
+	/// Bytes of the stream passed to Decode() so far.
+	size_t GetByteCount() const { return byteCount; }
+
+private:
+
+	/// Beginning of the sequence the last chunk ended in.
+	uint8_t pending[4] = { 0 };
+	size_t pendingCount = 0;
+
+	size_t byteCount = 0;
+	size_t errorOffset = kUtf8Valid;
+};
+
+/**
+ * Converts a null-terminated UTF-8 string to wide string (Unicode codepoints).
  * \return The new wide string.
  * \bug If an error occurs, an empty string is returned,
- * and SDL_Error is set; however, without querying SDL_Error,
- * there is no way to tell if that happened.
+ * and SDL_Error is set (with the offset of the invalid sequence);
+ * however, without querying SDL_Error, there is no way to tell if that happened.
+ * Use DecodeUtf8() to tell.
  */
 std::wstring MultibyteToWideString(const char* source);
+
+/**
+ * Like the above, for a string of the given length that need not be
+ * null-terminated (and may contain null characters).
+ */
+std::wstring MultibyteToWideString(const char* source, size_t length);
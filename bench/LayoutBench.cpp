@@ -0,0 +1,83 @@
+// Measures how much LayoutCache saves when a small set of messages is shown
+// over and over (as a status display would), compared to laying out every time.
+//
+// Usage: layoutbench <font file>
+
+#include "LoadFont.h"
+#include "MapFile.h"
+#include "SDLWrapper.h"
+#include "TextLayout.h"
+#include "LayoutCache.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+const char* MESSAGES[] = {
+	"Build OK",
+	"Build FAILED (3 errors)",
+	"Disk 91% full",
+	"build-server-03.example.org",
+	"Backup finished in 4 min 12 s",
+	"Πρόγνωση καιρού: βροχή",
+	"Обновление установлено",
+	"Low battery — 7% remaining",
+};
+const int MESSAGE_COUNT = sizeof(MESSAGES) / sizeof(MESSAGES[0]);
+const int ITERATIONS = 200000;
+
+int main(int argc, const char** argv)
+{
+	if (argc < 2) {
+		std::cerr << "Usage: layoutbench <font file>" << std::endl;
+		return 1;
+	}
+
+	SDL::Library libSDL(0);
+	MappedFile fontFile(argv[1]);
+	if (!fontFile.Ok()) {
+		std::cerr << "Could not open font file: " << SDL_GetError() << std::endl;
+		return 127;
+	}
+	FontCollection fontCollection(fontFile);
+	Font font(fontCollection, 32.0f, Font::kCharsetCyrillic|Font::kCharsetGreek);
+	if (!font.Ok()) {
+		std::cerr << "Could not load font: " << SDL_GetError() << std::endl;
+		return 127;
+	}
+
+	std::vector<Utf8Text> messages;
+	for (const char* message : MESSAGES) {
+		messages.emplace_back(message, strlen(message));
+	}
+
+	// the sum of advances keeps the work from being optimized away
+	double checksum = 0.0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ITERATIONS; i++) {
+		GlyphRun run = LayoutText(font, messages[i % MESSAGE_COUNT]);
+		checksum += run.advance;
+	}
+	auto end = std::chrono::steady_clock::now();
+	double uncachedNs = std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+
+	LayoutCache cache;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ITERATIONS; i++) {
+		const GlyphRun& run = cache.Get(font, messages[i % MESSAGE_COUNT]);
+		checksum -= run.advance;
+	}
+	end = std::chrono::steady_clock::now();
+	double cachedNs = std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+
+	LayoutCache::Stats stats = cache.GetStats();
+	std::cout << std::fixed << std::setprecision(0)
+		<< "uncached: " << uncachedNs << " ns per message" << std::endl
+		<< "cached:   " << cachedNs << " ns per message ("
+		<< stats.hits << " hits, " << stats.misses << " misses, "
+		<< stats.evictions << " evictions, " << stats.byteCount << " bytes)" << std::endl;
+	return checksum == 0.0 ? 0 : 1;
+}
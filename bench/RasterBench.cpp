@@ -0,0 +1,170 @@
+// Measures how glyph rasterization in Font::Font scales with the number of threads,
+// and checks that every thread count produces the same atlas as the serial one.
+// Then measures what each number of subpixel phases costs in time and atlas memory,
+// and compares one font holding all sizes in a shared atlas with one font per size.
+//
+// Usage: rasterbench <font file> [max threads]
+
+#include "LoadFont.h"
+#include "MapFile.h"
+#include "SDLWrapper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+const float FONT_SIZES[] = { 16.0f, 32.0f, 64.0f, 128.0f };
+const int REPETITIONS = 5;
+const uint32_t CHARSETS = Font::kCharsetCyrillic|Font::kCharsetGreek;
+
+/// Returns true if both fonts have the same atlas pixels and glyph geometry.
+bool SameAtlas(Font& a, Font& b)
+{
+	SDL::Surface& sa = a.GetSurface();
+	SDL::Surface& sb = b.GetSurface();
+	if (sa.GetWidth() != sb.GetWidth() || sa.GetHeight() != sb.GetHeight()) return false;
+	for (int y = 0; y < sa.GetHeight(); y++) {
+		const uint8_t* rowA = static_cast<const uint8_t*>(sa.GetPixels()) + y * sa.GetPitch();
+		const uint8_t* rowB = static_cast<const uint8_t*>(sb.GetPixels()) + y * sb.GetPitch();
+		if (memcmp(rowA, rowB, sa.GetWidth()) != 0) return false;
+	}
+	for (int c = 0; c < 0x500; c++) {
+		stbtt_packedchar ga, gb;
+		bool hasA = a.GetGlyphGeometry(c, ga);
+		bool hasB = b.GetGlyphGeometry(c, gb);
+		if (hasA != hasB) return false;
+		if (hasA && memcmp(&ga, &gb, sizeof(ga)) != 0) return false;
+	}
+	return true;
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc < 2) {
+		std::cerr << "Usage: rasterbench <font file> [max threads]" << std::endl;
+		return 1;
+	}
+	int maxThreads = (argc > 2) ? std::stoi(argv[2]) : int(std::max(1u, std::thread::hardware_concurrency()));
+
+	SDL::Library libSDL(0);
+	MappedFile fontFile(argv[1]);
+	if (!fontFile.Ok()) {
+		std::cerr << "Could not open font file: " << SDL_GetError() << std::endl;
+		return 127;
+	}
+	FontCollection fontCollection(fontFile);
+
+	std::vector<int> threadCounts;
+	for (int t = 1; t < maxThreads; t *= 2) {
+		threadCounts.push_back(t);
+	}
+	threadCounts.push_back(maxThreads);
+
+	std::cout << "size  threads  median ms  speedup  identical" << std::endl;
+	for (float fontSize : FONT_SIZES) {
+		Font reference(fontCollection, fontSize, CHARSETS, nullptr, 1);
+		if (!reference.Ok()) {
+			std::cerr << "Could not load font: " << SDL_GetError() << std::endl;
+			return 127;
+		}
+
+		double serialMs = 0.0;
+		for (int threadCount : threadCounts) {
+			std::vector<double> times;
+			bool identical = true;
+			for (int i = 0; i < REPETITIONS; i++) {
+				auto start = std::chrono::steady_clock::now();
+				Font font(fontCollection, fontSize, CHARSETS, nullptr, threadCount);
+				auto end = std::chrono::steady_clock::now();
+				times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+				identical = identical && font.Ok() && SameAtlas(reference, font);
+			}
+			std::sort(times.begin(), times.end());
+			double medianMs = times[times.size() / 2];
+			if (threadCount == 1) serialMs = medianMs;
+
+			std::cout << std::setw(4) << int(fontSize)
+				<< std::setw(9) << threadCount
+				<< std::setw(11) << std::fixed << std::setprecision(2) << medianMs
+				<< std::setw(8) << std::setprecision(2) << serialMs / medianMs << "x"
+				<< std::setw(11) << (identical ? "yes" : "NO")
+				<< std::endl;
+		}
+	}
+
+	std::cout << std::endl << "size  phases  median ms  atlas         KiB" << std::endl;
+	for (float fontSize : FONT_SIZES) {
+		for (int phases = 1; phases <= Font::kMaxSubpixelPhases; phases++) {
+			std::vector<double> times;
+			Font::AtlasStats stats;
+			for (int i = 0; i < REPETITIONS; i++) {
+				auto start = std::chrono::steady_clock::now();
+				Font font({ &fontCollection }, fontSize, CHARSETS, nullptr, maxThreads, Font::AtlasMode::kCoverage, phases);
+				auto end = std::chrono::steady_clock::now();
+				if (!font.Ok()) {
+					std::cerr << "Could not load font: " << SDL_GetError() << std::endl;
+					return 127;
+				}
+				times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+				stats = font.GetAtlasStats();
+			}
+			std::sort(times.begin(), times.end());
+
+			std::ostringstream atlasSize;
+			atlasSize << stats.width << "x" << stats.height;
+			std::cout << std::setw(4) << int(fontSize)
+				<< std::setw(8) << phases
+				<< std::setw(11) << std::fixed << std::setprecision(2) << times[times.size() / 2]
+				<< "  " << std::left << std::setw(11) << atlasSize.str() << std::right
+				<< std::setw(6) << (uint64_t(stats.width) * stats.height) / 1024
+				<< std::endl;
+		}
+	}
+
+	// every separate font is one more surface to upload and texture to bind
+	std::vector<float> allSizes(std::begin(FONT_SIZES), std::end(FONT_SIZES));
+	std::cout << std::endl << "sizes     atlases  median ms     KiB" << std::endl;
+	for (bool shared : { false, true }) {
+		std::vector<double> times;
+		uint64_t atlasBytes = 0;
+		for (int i = 0; i < REPETITIONS; i++) {
+			std::vector<std::unique_ptr<Font>> fonts;
+			auto start = std::chrono::steady_clock::now();
+			if (shared) {
+				fonts.emplace_back(new Font({ &fontCollection }, allSizes, CHARSETS, nullptr, maxThreads));
+			}
+			else {
+				for (float fontSize : allSizes) {
+					fonts.emplace_back(new Font(fontCollection, fontSize, CHARSETS, nullptr, maxThreads));
+				}
+			}
+			auto end = std::chrono::steady_clock::now();
+			times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+			atlasBytes = 0;
+			for (const std::unique_ptr<Font>& font : fonts) {
+				if (!font->Ok()) {
+					std::cerr << "Could not load font: " << SDL_GetError() << std::endl;
+					return 127;
+				}
+				Font::AtlasStats stats = font->GetAtlasStats();
+				atlasBytes += uint64_t(stats.width) * stats.height;
+			}
+		}
+		std::sort(times.begin(), times.end());
+
+		std::cout << std::left << std::setw(10) << (shared ? "shared" : "separate") << std::right
+			<< std::setw(7) << (shared ? 1 : allSizes.size())
+			<< std::setw(11) << std::fixed << std::setprecision(2) << times[times.size() / 2]
+			<< std::setw(8) << atlasBytes / 1024
+			<< std::endl;
+	}
+	return 0;
+}
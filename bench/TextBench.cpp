@@ -0,0 +1,553 @@
+// Microbenchmarks of every stage of the text pipeline, from decoding the message
+// (whole, or streamed in chunks) to uploading or streaming the composed text or drawing
+// glyph quads, over a range of font sizes, message lengths and scripts. Each case
+// is warmed up first, then timed repeatedly; the median and the 99th percentile
+// of the repetitions are reported, as a table on stderr and as JSON on stdout
+// (or in the given file), so that builds can be compared.
+//
+// Usage: textbench <font file> [--json <output file>] [--quick]
+//
+// Runs without a display under SDL_VIDEODRIVER=dummy (which it sets if nothing else is set).
+
+#include "LoadFont.h"
+#include "MapFile.h"
+#include "SDLWrapper.h"
+#include "TextLayout.h"
+#include "TextBlock.h"
+#include "GlyphBatch.h"
+#include "CoverageBlend.h"
+#include "SubpixelRender.h"
+#include "ToUnicode.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+const float FONT_SIZES[] = { 12.0f, 32.0f, 96.0f };
+const int MESSAGE_LENGTHS[] = { 16, 256, 4096 };
+
+/// Streamed input: characters per stream and bytes per chunk (a typical pipe read, and an odd
+/// size that splits many sequences).
+const int STREAM_LENGTH = 1 << 20;
+const size_t STREAM_CHUNKS[] = { 65536, 4096, 61 };
+
+/// Multi-line text: lines per text and the widths it is wrapped to.
+const int BLOCK_LINES = 10000;
+const int BLOCK_WIDTHS[] = { 600, 900 };
+const uint32_t CHARSETS = Font::kCharsetLatin|Font::kCharsetCyrillic|Font::kCharsetGreek;
+
+/// Sample text of each script; messages repeat it up to the wanted length.
+struct Script {
+	const char* name;
+	const char* text;
+};
+
+const Script SCRIPTS[] = {
+	{ "latin", "The quick brown fox jumps over the lazy dog. Příliš žluťoučký kůň úpěl ďábelské ódy. " },
+	{ "greek", "Ξεσκεπάζω την ψυχοφθόρα βδελυγμία. Τάχιστη αλώπηξ βαφής ψημένη γη. " },
+	{ "cyrillic", "Съешь же ещё этих мягких французских булок, да выпей чаю. " },
+	{ "mixed", "Build OK — сборка 7 · Πρόγνωση: βροχή · naïve café · " },
+};
+
+/// A sample takes at least this long; faster operations are repeated within a sample.
+const double MIN_SAMPLE_NS = 50000.0;
+const int MAX_BATCH = 1 << 20;
+const int WARMUPS = 3;
+
+/// Timing of one benchmark case.
+struct Result {
+	std::string name;
+	std::vector<std::pair<std::string, std::string>> params;	///< Name and JSON value.
+	int batch = 1;				///< Calls per sample.
+	int itemsPerCall = 1;		///< Characters, glyphs etc. handled per call.
+	std::vector<double> samples;	///< Nanoseconds per call, sorted.
+
+	double Percentile(double p) const
+	{
+		// nearest rank
+		size_t rank = size_t(p / 100.0 * samples.size() + 0.999999);
+		return samples[std::min(std::max(rank, size_t(1)), samples.size()) - 1];
+	}
+};
+
+/**
+ * Runs the case: calls fn() a few times to warm up (and to find how many calls
+ * make a sample long enough to time), then times the given number of samples.
+ */
+Result Measure(const std::string& name, std::vector<std::pair<std::string, std::string>> params,
+	int itemsPerCall, int repetitions, std::function<void()> fn)
+{
+	using Clock = std::chrono::steady_clock;
+
+	Result result;
+	result.name = name;
+	result.params = std::move(params);
+	result.itemsPerCall = itemsPerCall;
+
+	// the warmup doubles the batch until a sample takes long enough
+	for (int warmup = 1; ; warmup++) {
+		auto start = Clock::now();
+		for (int i = 0; i < result.batch; i++) fn();
+		double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		if (ns < MIN_SAMPLE_NS && result.batch < MAX_BATCH) {
+			result.batch *= 2;
+		}
+		else if (warmup >= WARMUPS) {
+			break;
+		}
+	}
+
+	for (int r = 0; r < repetitions; r++) {
+		auto start = Clock::now();
+		for (int i = 0; i < result.batch; i++) fn();
+		double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		result.samples.push_back(ns / result.batch);
+	}
+	std::sort(result.samples.begin(), result.samples.end());
+	return result;
+}
+
+/// Returns the sample text of the script repeated (and cut at a character boundary) to the given number of characters.
+std::string MakeMessage(const Script& script, int length)
+{
+	std::string message;
+	const char* p = script.text;
+	for (int count = 0; count < length; count++) {
+		if (!*p) p = script.text;
+		do {
+			message += *p++;
+		} while ((*p & 0xc0) == 0x80);
+	}
+	return message;
+}
+
+/// Returns the text as a JSON string literal.
+std::string JsonString(const std::string& text)
+{
+	std::string result = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			result += '\\';
+			result += c;
+		}
+		else if (uint8_t(c) < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			result += escaped;
+		}
+		else {
+			result += c;
+		}
+	}
+	return result + "\"";
+}
+
+std::string JsonNumber(double value)
+{
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1) << value;
+	return out.str();
+}
+
+void WriteJson(std::ostream& out, const std::string& fontPath, const std::vector<Result>& results)
+{
+	const char* videoDriver = SDL_GetCurrentVideoDriver();
+
+	// the blit and upload cases measure SDL itself, so their numbers hold only for the SDL they ran against
+	SDL_version linked;
+	SDL_GetVersion(&linked);
+	std::string sdlVersion = std::to_string(linked.major) + "." + std::to_string(linked.minor) + "." + std::to_string(linked.patch);
+
+	out << "{\n";
+	out << "\t\"benchmark\": \"textbench\",\n";
+	out << "\t\"font\": " << JsonString(fontPath) << ",\n";
+	out << "\t\"sdl_version\": " << JsonString(sdlVersion) << ",\n";
+	out << "\t\"video_driver\": " << JsonString(videoDriver ? videoDriver : "") << ",\n";
+	out << "\t\"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		out << "\t\t{ \"name\": " << JsonString(r.name) << ", \"params\": { ";
+		for (size_t j = 0; j < r.params.size(); j++) {
+			out << (j ? ", " : "") << JsonString(r.params[j].first) << ": " << r.params[j].second;
+		}
+		out << " }, \"repetitions\": " << r.samples.size()
+			<< ", \"batch\": " << r.batch
+			<< ", \"items\": " << r.itemsPerCall
+			<< ", \"min_ns\": " << JsonNumber(r.samples.front())
+			<< ", \"median_ns\": " << JsonNumber(r.Percentile(50))
+			<< ", \"p99_ns\": " << JsonNumber(r.Percentile(99))
+			<< " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "\t]\n";
+	out << "}\n";
+}
+
+void PrintRow(const Result& r)
+{
+	std::ostringstream params;
+	for (const auto& param : r.params) {
+		params << param.first << "=" << param.second << " ";
+	}
+	std::string paramText = params.str();
+	paramText.erase(std::remove(paramText.begin(), paramText.end(), '"'), paramText.end());
+
+	std::cerr << std::left << std::setw(24) << r.name << std::setw(32) << paramText << std::right
+		<< std::fixed << std::setprecision(1)
+		<< std::setw(14) << r.Percentile(50)
+		<< std::setw(14) << r.Percentile(99)
+		<< std::setw(10) << r.Percentile(50) / r.itemsPerCall
+		<< std::endl;
+}
+
+int main(int argc, const char** argv)
+{
+	std::string fontPath, jsonPath;
+	bool quick = false;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+			jsonPath = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--quick")) {
+			quick = true;
+		}
+		else if (fontPath.empty() && argv[i][0] != '-') {
+			fontPath = argv[i];
+		}
+		else {
+			fontPath.clear();
+			break;
+		}
+	}
+	if (fontPath.empty()) {
+		std::cerr << "Usage: textbench <font file> [--json <output file>] [--quick]" << std::endl;
+		return 1;
+	}
+
+	// no window is ever shown, so no display is needed
+	SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+	SDL::Library libSDL(SDL_INIT_VIDEO);
+	if (!libSDL.Ok()) {
+		std::cerr << "Could not initialize SDL: " << SDL_GetError() << std::endl;
+		return 127;
+	}
+
+	MappedFile fontFile(fontPath.c_str());
+	if (!fontFile.Ok()) {
+		std::cerr << "Could not open font file: " << SDL_GetError() << std::endl;
+		return 127;
+	}
+	FontCollection fontCollection(fontFile);
+
+	const int fastRepetitions = quick ? 20 : 200;
+	const int slowRepetitions = quick ? 3 : 15;
+
+	std::vector<Result> results;
+	auto add = [&results](Result result) {
+		PrintRow(result);
+		results.push_back(std::move(result));
+	};
+	std::cerr << std::left << std::setw(24) << "stage" << std::setw(32) << "parameters" << std::right
+		<< std::setw(14) << "median ns" << std::setw(14) << "p99 ns" << std::setw(10) << "ns/item" << std::endl;
+
+	// loading: packing and rasterizing the atlas (single-threaded, so that the result does not depend on the machine's cores)
+	for (float fontSize : FONT_SIZES) {
+		add(Measure("font_load", { { "size", JsonNumber(fontSize) } }, 1, slowRepetitions, [&]() {
+			Font font(fontCollection, fontSize, CHARSETS, nullptr, 1);
+			if (!font.Ok()) {
+				std::cerr << "Could not load font: " << SDL_GetError() << std::endl;
+				exit(127);
+			}
+		}));
+	}
+
+	Font font(fontCollection, 32.0f, CHARSETS);
+	if (!font.Ok()) {
+		std::cerr << "Could not load font: " << SDL_GetError() << std::endl;
+		return 127;
+	}
+
+	// the checksum keeps the work from being optimized away
+	int64_t checksum = 0;
+
+	for (const Script& script : SCRIPTS) {
+		for (int length : MESSAGE_LENGTHS) {
+			std::vector<std::pair<std::string, std::string>> params = {
+				{ "script", JsonString(script.name) }, { "length", std::to_string(length) }
+			};
+			std::string message = MakeMessage(script, length);
+			std::wstring text = MultibyteToWideString(message.c_str());
+
+			add(Measure("decode_utf8", params, length, fastRepetitions, [&]() {
+				checksum += MultibyteToWideString(message.c_str()).size();
+			}));
+			add(Measure("glyph_lookup", params, length, fastRepetitions, [&]() {
+				int64_t sum = 0;
+				for (wchar_t c : text) {
+					stbtt_packedchar glyph;
+					if (font.GetGlyphGeometry(int(c), glyph)) sum += glyph.x0;
+				}
+				checksum += sum;
+			}));
+			add(Measure("compute_text_size", params, length, fastRepetitions, [&]() {
+				checksum += font.ComputeTextSize(text).w;
+			}));
+			add(Measure("layout_text", params, length, fastRepetitions, [&]() {
+				checksum += LayoutText(font, text).advance;
+			}));
+
+			// the same straight from the UTF-8 bytes, decoding included
+			Utf8Text utf8Text(message.data(), message.size());
+			add(Measure("compute_text_size_utf8", params, length, fastRepetitions, [&]() {
+				checksum += font.ComputeTextSize(utf8Text).w;
+			}));
+			add(Measure("layout_utf8", params, length, fastRepetitions, [&]() {
+				checksum += LayoutText(font, utf8Text).advance;
+			}));
+		}
+	}
+
+	// streaming: decoding MB-sized input in chunks, against decoding it whole
+	for (const Script& script : SCRIPTS) {
+		std::string message = MakeMessage(script, STREAM_LENGTH);
+		add(Measure("decode_whole", { { "script", JsonString(script.name) }, { "length", std::to_string(STREAM_LENGTH) } },
+			STREAM_LENGTH, slowRepetitions, [&]() {
+			checksum += MultibyteToWideString(message.data(), message.size()).size();
+		}));
+
+		std::vector<wchar_t> codepoints(message.size());
+		for (size_t chunk : STREAM_CHUNKS) {
+			add(Measure("decode_stream", { { "script", JsonString(script.name) }, { "length", std::to_string(STREAM_LENGTH) },
+				{ "chunk", std::to_string(chunk) } }, STREAM_LENGTH, slowRepetitions, [&]() {
+				Utf8Decoder decoder;
+				size_t count = 0;
+				for (size_t offset = 0; offset < message.size(); offset += chunk) {
+					count += decoder.Decode(message.data() + offset, std::min(chunk, message.size() - offset),
+						codepoints.data() + count);
+				}
+				checksum += decoder.Finish() ? count : 0;
+			}));
+		}
+	}
+
+	// wrapping: 10k lines of varied length, laid out and wrapped from scratch, re-wrapped to another width,
+	// and with one line changed
+	for (const Script& script : SCRIPTS) {
+		std::string text;
+		for (int i = 0; i < BLOCK_LINES; i++) {
+			text += MakeMessage(script, 10 + (i * 37) % 120) + "\n";
+		}
+		Utf8Text blockText(text.data(), text.size());
+		std::vector<std::pair<std::string, std::string>> params = {
+			{ "script", JsonString(script.name) }, { "lines", std::to_string(BLOCK_LINES) }
+		};
+
+		add(Measure("wrap_layout", params, BLOCK_LINES, slowRepetitions, [&]() {
+			TextBlock block(font);
+			block.SetText(blockText);
+			block.SetWidth(BLOCK_WIDTHS[0]);
+			checksum += block.GetLines().size();
+		}));
+
+		TextBlock block(font);
+		block.SetText(blockText);
+		int resizes = 0;
+		add(Measure("wrap_resize", params, BLOCK_LINES, slowRepetitions, [&]() {
+			block.SetWidth(BLOCK_WIDTHS[resizes++ % 2]);
+			checksum += block.GetLines().size();
+		}));
+
+		const std::string edits[] = { MakeMessage(script, 40), MakeMessage(script, 90) };
+		int editCount = 0;
+		add(Measure("wrap_edit_line", params, 1, slowRepetitions, [&]() {
+			const std::string& edit = edits[editCount++ % 2];
+			block.SetParagraph(BLOCK_LINES / 2, Utf8Text(edit.data(), edit.size()));
+			checksum += block.GetLines().size();
+		}));
+	}
+
+	// composing: blitting or blending the glyphs of a line into the message surface, at every size
+	for (float fontSize : FONT_SIZES) {
+		Font sizedFont(fontCollection, fontSize, CHARSETS);
+		if (!sizedFont.Ok()) {
+			std::cerr << "Could not load font: " << SDL_GetError() << std::endl;
+			return 127;
+		}
+		for (const Script& script : SCRIPTS) {
+			const int length = 64;
+			GlyphRun run = LayoutText(sizedFont, MultibyteToWideString(MakeMessage(script, length).c_str()));
+			SDL::Surface messageSurface(PenToNearestPixel(run.advance) + int(fontSize) * 2, int(fontSize) * 3,
+				32, SDL_PIXELFORMAT_RGBA32);
+			int baselineY = int(fontSize) * 2;
+
+			add(Measure("blit_glyphs", { { "size", JsonNumber(fontSize) }, { "script", JsonString(script.name) },
+				{ "length", std::to_string(length) } }, int(run.glyphs.size()), fastRepetitions, [&]() {
+				for (const PositionedGlyph& glyph : run.glyphs) {
+					const stbtt_packedchar& g = glyph.geometry;
+					SDL::Rect glyphRect(g.x0, g.y0, g.x1 - g.x0, g.y1 - g.y0);
+					SDL::Rect destRect(PenToNearestPixel(glyph.x) + int(fontSize) + g.xoff, baselineY + g.yoff,
+						g.x1 - g.x0, g.y1 - g.y0);
+					sizedFont.GetSurface().Blit(glyphRect, messageSurface, destRect);
+				}
+			}));
+
+			// the same glyphs blended in by their coverage
+			CoverageBlend blend(messageSurface.GetFormat(), SDL_Color { 0xff, 0xff, 0xff, 0xff });
+			add(Measure("blend_glyphs", { { "size", JsonNumber(fontSize) }, { "script", JsonString(script.name) },
+				{ "length", std::to_string(length) } }, int(run.glyphs.size()), fastRepetitions, [&]() {
+				for (const PositionedGlyph& glyph : run.glyphs) {
+					DrawSubpixelGlyph(sizedFont.GetSurface(), glyph.geometry, 1, messageSurface,
+						glyph.x + PixelsToPen(fontSize), baselineY, blend);
+				}
+			}));
+		}
+
+		// a whole wrapped message composed into its box over the background, either way
+		const int messageLength = MESSAGE_LENGTHS[std::size(MESSAGE_LENGTHS) - 1];
+		std::string message = MakeMessage(SCRIPTS[0], messageLength);
+		TextBlock block(sizedFont);
+		block.SetText(Utf8Text(message.data(), message.size()));
+		block.SetWidth(BLOCK_WIDTHS[1]);
+		SDL_Rect bounds = block.GetBounds();
+		SDL::Surface blockSurface(bounds.w + 2, bounds.h + 2, 32, SDL_PIXELFORMAT_RGBA32);
+		const uint32_t background = SDL_MapRGBA(blockSurface.GetFormat(), 0x0f, 0x0f, 0x0f, 0xff);
+		CoverageBlend blockBlend(blockSurface.GetFormat(), SDL_Color { 0xff, 0xff, 0xff, 0xff });
+		int blockGlyphs = 0;
+		for (const WrappedLine& line : block.GetLines()) {
+			blockGlyphs += line.glyphCount;
+		}
+		auto composeMessage = [&](bool blend) {
+			SDL_FillRect(blockSurface, nullptr, background);
+			for (const WrappedLine& line : block.GetLines()) {
+				const GlyphRun& run = block.GetRun(line);
+				int baselineY = 1 - bounds.y + line.baselineY;
+				for (int i = line.firstGlyph; i < line.firstGlyph + line.glyphCount; i++) {
+					const PositionedGlyph& glyph = run.glyphs[i];
+					const stbtt_packedchar& g = glyph.geometry;
+					int32_t penX = PixelsToPen(float(1 - bounds.x)) + int32_t(glyph.x - line.startX);
+					if (blend) {
+						DrawSubpixelGlyph(sizedFont.GetSurface(), g, 1, blockSurface, penX, baselineY, blockBlend);
+					}
+					else {
+						SDL::Rect glyphRect(g.x0, g.y0, g.x1 - g.x0, g.y1 - g.y0);
+						SDL::Rect destRect(PenToNearestPixel(penX) + g.xoff, baselineY + g.yoff, g.x1 - g.x0, g.y1 - g.y0);
+						sizedFont.GetSurface().Blit(glyphRect, blockSurface, destRect);
+					}
+				}
+			}
+		};
+		std::vector<std::pair<std::string, std::string>> params = {
+			{ "size", JsonNumber(fontSize) }, { "length", std::to_string(messageLength) },
+			{ "width", std::to_string(BLOCK_WIDTHS[1]) }
+		};
+		add(Measure("blit_message", params, blockGlyphs, slowRepetitions * 4, [&]() { composeMessage(false); }));
+		add(Measure("blend_message", params, blockGlyphs, slowRepetitions * 4, [&]() { composeMessage(true); }));
+	}
+
+	// the blend kernel on its own against the scalar reference, on a row with empty, solid and edge pixels
+	{
+		const int rowLength = 1024;
+		std::vector<uint8_t> coverage(rowLength);
+		for (int i = 0; i < rowLength; i++) {
+			coverage[i] = (i % 24 < 8) ? 0 : (i % 24 < 16) ? 255 : uint8_t(i * 73);
+		}
+		std::vector<uint32_t> row(rowLength, 0xff0f0f0fu);
+		SDL::Surface formatSurface(1, 1, 32, SDL_PIXELFORMAT_RGBA32);
+		CoverageBlend blend(formatSurface.GetFormat(), SDL_Color { 0xff, 0xff, 0xff, 0xff });
+		add(Measure("blend_row", { { "kernel", JsonString(CoverageBlend::GetKernelName()) } }, rowLength,
+			fastRepetitions, [&]() {
+			blend.BlendRow(coverage.data(), row.data(), rowLength);
+		}));
+		add(Measure("blend_row", { { "kernel", JsonString("scalar") } }, rowLength, fastRepetitions, [&]() {
+			CoverageBlend::BlendRowScalar(coverage.data(), row.data(), rowLength, blend.GetPixel());
+		}));
+		checksum += row[rowLength - 1];
+	}
+
+	// uploading: turning the composed surface into a texture (with the software renderer of the dummy driver)
+	SDL_Window* window = SDL_CreateWindow("textbench", 0, 0, 640, 480, SDL_WINDOW_HIDDEN);
+	if (window) {
+		SDL::Renderer renderer(window, -1, SDL_RENDERER_SOFTWARE);
+		if (renderer.Ok()) {
+			for (float fontSize : FONT_SIZES) {
+				SDL::Surface messageSurface(int(fontSize) * 32, int(fontSize) * 3, 32, SDL_PIXELFORMAT_RGBA32);
+				add(Measure("texture_upload", { { "size", JsonNumber(fontSize) } },
+					messageSurface.GetWidth() * messageSurface.GetHeight(), slowRepetitions * 4, [&]() {
+					SDL::Texture texture(renderer, messageSurface);
+					checksum += texture.Ok();
+				}));
+
+				// or composing straight into a streaming texture: what it costs besides the glyphs
+				SDL::StreamingTexture streamingTexture(renderer, SDL::StreamingTexture::GetNativeFormat(renderer),
+					messageSurface.GetWidth(), messageSurface.GetHeight());
+				if (!streamingTexture.Ok()) {
+					std::cerr << "Streaming textures not measured: " << SDL_GetError() << std::endl;
+					continue;
+				}
+				add(Measure("texture_stream", { { "size", JsonNumber(fontSize) } },
+					messageSurface.GetWidth() * messageSurface.GetHeight(), slowRepetitions * 4, [&]() {
+					if (!streamingTexture.Lock()) return;
+					SDL::Surface lockedSurface(streamingTexture.GetPixels(), streamingTexture.GetWidth(),
+						streamingTexture.GetHeight(), 32, streamingTexture.GetPitch(), streamingTexture.GetFormat());
+					checksum += SDL_FillRect(lockedSurface, nullptr, 0) == 0;
+					streamingTexture.Unlock();
+				}));
+			}
+
+			// drawing a line of glyph quads from the atlas texture instead (filling the batch, then one draw call)
+			for (float fontSize : FONT_SIZES) {
+				Font sizedFont(fontCollection, fontSize, CHARSETS);
+				GlyphBatch batch(renderer, sizedFont);
+				if (!batch.Ok()) {
+					std::cerr << "Glyph batches not measured: " << SDL_GetError() << std::endl;
+					break;
+				}
+				const int length = 64;
+				GlyphRun run = LayoutText(sizedFont, MultibyteToWideString(MakeMessage(SCRIPTS[0], length).c_str()));
+				int baselineY = int(fontSize) * 2;
+				std::vector<std::pair<std::string, std::string>> params = {
+					{ "size", JsonNumber(fontSize) }, { "length", std::to_string(length) }
+				};
+				add(Measure("batch_fill", params, int(run.glyphs.size()), fastRepetitions, [&]() {
+					batch.Clear();
+					for (const PositionedGlyph& glyph : run.glyphs) {
+						batch.AddGlyph(run, glyph, glyph.x, baselineY, SDL_Color { 0xff, 0xff, 0xff, 0xff });
+					}
+					checksum += batch.GetGlyphCount();
+				}));
+				// SDL queues render commands, so the queue is flushed to time the actual drawing
+				add(Measure("batch_draw", params, batch.GetGlyphCount(), slowRepetitions * 4, [&]() {
+					checksum += batch.Draw();
+					SDL_RenderFlush(renderer);
+				}));
+			}
+		}
+		SDL_DestroyWindow(window);
+	}
+	else {
+		std::cerr << "Could not create window, texture upload not measured: " << SDL_GetError() << std::endl;
+	}
+
+	std::cerr << "checksum " << checksum << std::endl;
+	if (jsonPath.empty()) {
+		WriteJson(std::cout, fontPath, results);
+	}
+	else {
+		std::ofstream out(jsonPath);
+		WriteJson(out, fontPath, results);
+		if (!out) {
+			std::cerr << "Could not write " << jsonPath << std::endl;
+			return 127;
+		}
+	}
+	return 0;
+}
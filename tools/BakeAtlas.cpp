@@ -0,0 +1,178 @@
+// Packs the atlas of a font with Font and writes it out as a C++ source file
+// that defines GetBakedAtlas() (see BakedAtlas.h), to be compiled into sdlmessage.
+//
+// Usage: bakeatlas <font file> <font size> <output file>
+//
+// If the font file does not exist, the output defines GetBakedAtlas() returning null,
+// so that the build does not depend on the font being installed.
+
+#include "LoadFont.h"
+#include "MapFile.h"
+#include "FileUtil.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+const uint32_t CHARSETS = Font::kCharsetLatin|Font::kCharsetCyrillic|Font::kCharsetGreek;
+
+/// Appends printf-style formatted text to the string.
+void Append(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+void Append(std::string& out, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	va_list argsCopy;
+	va_copy(argsCopy, args);
+	int length = vsnprintf(nullptr, 0, format, args);
+	va_end(args);
+
+	size_t start = out.size();
+	out.resize(start + length + 1);
+	vsnprintf(&out[start], length + 1, format, argsCopy);
+	va_end(argsCopy);
+	out.resize(start + length);
+}
+
+/// Returns the C++ string literal for the text.
+std::string Quote(const std::string& text)
+{
+	std::string result = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\') result += '\\';
+		result += c;
+	}
+	return result + "\"";
+}
+
+/// Source of a GetBakedAtlas() that has nothing to offer.
+std::string EmptySource(const std::string& fontPath)
+{
+	std::string out;
+	out += "// Generated by tools/BakeAtlas.cpp, do not edit.\n";
+	Append(out, "// No atlas was baked (%s was not available at build time).\n\n", fontPath.c_str());
+	out += "#include \"BakedAtlas.h\"\n\n";
+	out += "const BakedAtlas* GetBakedAtlas()\n{\n\treturn nullptr;\n}\n";
+	return out;
+}
+
+/// Source of a GetBakedAtlas() that returns the atlas of the font.
+std::string AtlasSource(const std::string& fontPath, float fontSize, Font& font)
+{
+	// only glyphs the font really has; anything else must come from a fallback font at runtime
+	std::vector<int32_t> codepoints;
+	std::vector<stbtt_packedchar> glyphs;
+	for (uint32_t c = 0; c < CodepointTable::kCodepointLimit; c++) {
+		stbtt_packedchar glyph;
+		if (font.FindFace(c) >= 0 && font.GetGlyphGeometry(int(c), glyph)) {
+			codepoints.push_back(int32_t(c));
+			glyphs.push_back(glyph);
+		}
+	}
+
+	SDL::Surface& surface = font.GetSurface();
+	const uint8_t* pixels = static_cast<const uint8_t*>(surface.GetPixels());
+	int width = surface.GetWidth();
+	int height = surface.GetHeight();
+
+	std::string out;
+	out += "// Generated by tools/BakeAtlas.cpp, do not edit.\n";
+	Append(out, "// Atlas of %s at %g px, %zu glyphs.\n\n", fontPath.c_str(), fontSize, glyphs.size());
+	out += "#include \"BakedAtlas.h\"\n\n";
+	out += "namespace {\n\n";
+
+	out += "constexpr int32_t kCodepoints[] = {";
+	for (size_t i = 0; i < codepoints.size(); i++) {
+		Append(out, "%s0x%x,", (i % 16) ? " " : "\n\t", codepoints[i]);
+	}
+	out += "\n};\n\n";
+
+	// hexadecimal floats keep the geometry bit-exact
+	out += "constexpr stbtt_packedchar kGlyphs[] = {\n";
+	for (const stbtt_packedchar& g : glyphs) {
+		Append(out, "\t{ %d, %d, %d, %d, %a, %a, %a, %a, %a },\n",
+			g.x0, g.y0, g.x1, g.y1, g.xoff, g.yoff, g.xadvance, g.xoff2, g.yoff2);
+	}
+	out += "};\n\n";
+
+	// rows are stored without padding, so the pitch is the width
+	std::vector<KerningPair> kerningPairs = font.GetKerningTable().GetPairs();
+	out += "constexpr KerningPair kKerningPairs[] = {\n";
+	for (const KerningPair& pair : kerningPairs) {
+		Append(out, "\t{ 0x%x, 0x%x, %d },\n", pair.left, pair.right, pair.advance);
+	}
+	if (kerningPairs.empty()) {
+		out += "\t{ 0, 0, 0 }\n";		// no empty arrays in C++
+	}
+	out += "};\n\n";
+
+	out += "constexpr uint8_t kPixels[] = {";
+	for (int y = 0; y < height; y++) {
+		const uint8_t* row = pixels + y * surface.GetPitch();
+		for (int x = 0; x < width; x++) {
+			Append(out, "%s%d,", ((y * width + x) % 32) ? "" : "\n\t", row[x]);
+		}
+	}
+	out += "\n};\n\n";
+
+	out += "constexpr BakedAtlas kAtlas = {\n";
+	Append(out, "\t.fontPath = %s,\n", Quote(fontPath).c_str());
+	Append(out, "\t.fontSize = %a,\n", fontSize);
+	Append(out, "\t.charsets = 0x%x,\n", CHARSETS);
+	Append(out, "\t.glyphCount = %zu,\n", glyphs.size());
+	out += "\t.codepoints = kCodepoints,\n";
+	out += "\t.glyphs = kGlyphs,\n";
+	Append(out, "\t.kerningPairCount = %zu,\n", kerningPairs.size());
+	out += "\t.kerningPairs = kKerningPairs,\n";
+	Append(out, "\t.width = %d,\n", width);
+	Append(out, "\t.height = %d,\n", height);
+	Append(out, "\t.pitch = %d,\n", width);
+	out += "\t.pixels = kPixels\n";
+	out += "};\n\n";
+	out += "} // namespace\n\n";
+
+	out += "const BakedAtlas* GetBakedAtlas()\n{\n\treturn &kAtlas;\n}\n";
+	return out;
+}
+
+int main(int argc, const char** argv)
+{
+	if (argc != 4) {
+		std::cerr << "Usage: bakeatlas <font file> <font size> <output file>" << std::endl;
+		return 1;
+	}
+	std::string fontPath = argv[1];
+	float fontSize = std::stof(argv[2]);
+	std::string outputPath = argv[3];
+
+	std::string source;
+	struct stat fontStat;
+	if (stat(fontPath.c_str(), &fontStat) != 0) {
+		std::cerr << "bakeatlas: warning: " << fontPath << " not found, no atlas is baked" << std::endl;
+		source = EmptySource(fontPath);
+	}
+	else {
+		MappedFile fontFile(fontPath.c_str());
+		if (!fontFile.Ok()) {
+			std::cerr << "bakeatlas: could not open font file: " << SDL_GetError() << std::endl;
+			return 127;
+		}
+		FontCollection fontCollection(fontFile);
+		Font font(fontCollection, fontSize, CHARSETS);
+		if (!font.Ok()) {
+			std::cerr << "bakeatlas: could not load font: " << SDL_GetError() << std::endl;
+			return 127;
+		}
+		source = AtlasSource(fontPath, fontSize, font);
+	}
+
+	if (!WriteFileAtomically(outputPath, { { source.data(), source.size() } })) {
+		std::cerr << "bakeatlas: could not write " << outputPath << ": " << SDL_GetError() << std::endl;
+		return 127;
+	}
+	return 0;
+}